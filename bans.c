@@ -0,0 +1,109 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <ctype.h>
+
+#include "bans.h"
+
+// fnv-1a, collision of two hwids in 64 bits is not a concern. mysql compared hwids
+// case insensitive and without trailing spaces, so other case or padding is same ban
+static unsigned long long bans_hash( const char* hwid )
+{
+	unsigned long long hash;
+	const char* end;
+
+	for( end = hwid; *end; ++end );
+	for( ; end > hwid && end[-1] == ' '; --end );
+
+	for( hash = 14695981039346656037ull; hwid < end; ++hwid )
+		hash = ( hash ^ ( byte )tolower( ( byte )*hwid ) ) * 1099511628211ull;
+
+	return hash ? hash : 1;
+}
+
+bans_t* bans_create( unsigned count )
+{
+	bans_t* bans;
+	unsigned n;
+
+	for( n = 16; n < count * 2; n <<= 1 );
+
+	if( ( bans = ( bans_t * )calloc( 1, sizeof( bans_t ) + ( n - 1 ) * sizeof( unsigned long long ) ) ) == NULL )
+	{
+		fprintf( stderr, "bans_create: out of memory\n" );
+		return NULL;
+	}
+
+	bans->mask = n - 1;
+
+	return bans;
+}
+
+bans_t* bans_copy( const bans_t* bans, unsigned count )
+{
+	bans_t* copy;
+	unsigned i;
+
+	if( ( copy = bans_create( count > bans->count ? count : bans->count ) ) == NULL )
+		return NULL;
+
+	for( i = 0; i <= bans->mask; ++i )
+	{
+		if( bans->keys[i] )
+		{
+			unsigned j;
+
+			for( j = ( unsigned )bans->keys[i] & copy->mask; copy->keys[j]; j = ( j + 1 ) & copy->mask );
+
+			copy->keys[j] = bans->keys[i];
+		}
+	}
+
+	copy->count		= bans->count;
+	copy->last_id	= bans->last_id;
+
+	return copy;
+}
+
+void bans_free( bans_t* bans )
+{
+	free( ( void *)bans );
+}
+
+int bans_add( bans_t* bans, const char* hwid )
+{
+	unsigned long long key;
+	unsigned i;
+
+	if( bans->count * 2 >= bans->mask + 1 )
+		return 0;
+
+	key = bans_hash( hwid );
+
+	for( i = ( unsigned )key & bans->mask; bans->keys[i]; i = ( i + 1 ) & bans->mask )
+	{
+		// same hwid banned twice
+		if( bans->keys[i] == key )
+			return 1;
+	}
+
+	bans->keys[i] = key;
+	++bans->count;
+
+	return 1;
+}
+
+int bans_find( const bans_t* bans, const char* hwid )
+{
+	unsigned long long key;
+	unsigned i;
+
+	key = bans_hash( hwid );
+
+	for( i = ( unsigned )key & bans->mask; bans->keys[i]; i = ( i + 1 ) & bans->mask )
+	{
+		if( bans->keys[i] == key )
+			return 1;
+	}
+
+	return 0;
+}
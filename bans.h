@@ -0,0 +1,23 @@
+#ifndef BANS_H
+#define BANS_H
+
+#include "epoch.h"
+
+// set of banned hwids as 64 bit hashes, open addressing. set is never changed after it is published,
+// refresh makes new one and old is retired through epoch
+typedef struct bans_s
+{
+	epoch_node_t			retired;
+	unsigned				mask;
+	unsigned				count;
+	unsigned				last_id;	// biggest ban id in set
+	unsigned long long		keys[1];	// 0 is empty slot
+} bans_t;
+
+bans_t* bans_create( unsigned count ); // room for count bans at half load
+bans_t* bans_copy( const bans_t* bans, unsigned count ); // copy with room for count bans
+void bans_free( bans_t* bans );
+int bans_add( bans_t* bans, const char* hwid ); // returns 0 if set is half full
+int bans_find( const bans_t* bans, const char* hwid );
+
+#endif // BANS_H
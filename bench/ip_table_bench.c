@@ -0,0 +1,80 @@
+// lookup cost of ip table variant it is built with. make bench builds and runs both
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "ip_table.h"
+
+#define BENCH_LOOKUPS	( 1 << 22 )
+
+#ifdef IP_TABLE_SIMD
+	#define BENCH_NAME	"simd"
+#else
+	#define BENCH_NAME	"hash"
+#endif
+
+static unsigned bench_random( unsigned* state )
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+static double bench_now()
+{
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// ns per lookup of ips, misses are other random ips
+static double bench_lookups( ip_table_t* table, const ip_t* ips, unsigned count, int hit )
+{
+	unsigned i, seed, found;
+	double start;
+
+	seed	= 12345;
+	found	= 0;
+	start	= bench_now();
+
+	for( i = 0; i < BENCH_LOOKUPS; ++i )
+		found += ip_table_find( table, hit ? ips[i & ( count - 1 )] : bench_random( &seed ) | 1 ) != NULL;
+
+	// keeps loop from being optimized out
+	if( found == ~0u )
+		puts( "" );
+
+	return ( bench_now() - start ) / BENCH_LOOKUPS;
+}
+
+int main()
+{
+	static const unsigned counts[] = { 16, 64, 256, 1024, 4096 };
+	ip_table_t table;
+	ip_t* ips;
+	unsigned i, c, seed;
+
+	for( c = 0; c < sizeof counts / sizeof counts[0]; ++c )
+	{
+		// same load factor as default config, table twice more than clients
+		if( !ip_table_init( &table, counts[c] * 2 ) || ( ips = ( ip_t * )malloc( counts[c] * sizeof( ip_t ) ) ) == NULL )
+			return EXIT_FAILURE;
+
+		for( i = 0, seed = 2463534242u; i < counts[c]; ++i )
+		{
+			ips[i] = bench_random( &seed ) | 1;
+			ip_table_add( &table, ips[i], ips + i );
+		}
+
+		printf( "%s %5u clients: hit %6.1f ns, miss %6.1f ns\n", BENCH_NAME, counts[c],
+			bench_lookups( &table, ips, counts[c], 1 ), bench_lookups( &table, ips, counts[c], 0 ) );
+
+		ip_table_free( &table );
+		free( ( void *)ips );
+	}
+
+	return EXIT_SUCCESS;
+}
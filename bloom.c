@@ -0,0 +1,93 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <ctype.h>
+
+#include "bloom.h"
+
+// logins compare case insensitive and without trailing spaces in mysql. other bytes than ascii
+// could be equal by collation rules, such login has no key and is never rejected
+static int bloom_key( const char* login, unsigned* h1, unsigned* h2 )
+{
+	unsigned long long hash;
+	const char* end;
+
+	for( end = login; *end; ++end );
+	for( ; end > login && end[-1] == ' '; --end );
+
+	for( hash = 14695981039346656037ull; login < end; ++login )
+	{
+		if( ( byte )*login >= 0x80 )
+			return 0;
+
+		hash = ( hash ^ ( byte )tolower( ( byte )*login ) ) * 1099511628211ull;
+	}
+
+	// double hashing, second one is odd to walk all bits
+	*h1 = ( unsigned )hash;
+	*h2 = ( unsigned )( hash >> 32 ) | 1;
+
+	return 1;
+}
+
+bloom_t* bloom_create( unsigned capacity )
+{
+	bloom_t* bloom;
+	unsigned n;
+
+	if( capacity < BLOOM_MIN_CAPACITY )
+		capacity = BLOOM_MIN_CAPACITY;
+
+	for( n = 32; n < capacity * BLOOM_BITS_PER_KEY; n <<= 1 );
+
+	if( ( bloom = ( bloom_t * )calloc( 1, sizeof( bloom_t ) + ( n / 32 - 1 ) * sizeof( atomic_uint ) ) ) == NULL )
+	{
+		fprintf( stderr, "bloom_create: out of memory\n" );
+		return NULL;
+	}
+
+	bloom->mask		= n - 1;
+	bloom->capacity	= capacity;
+
+	return bloom;
+}
+
+void bloom_free( bloom_t* bloom )
+{
+	free( ( void *)bloom );
+}
+
+void bloom_add( bloom_t* bloom, const char* login )
+{
+	unsigned h1, h2, bit;
+	int i;
+
+	if( !bloom_key( login, &h1, &h2 ) )
+		return;
+
+	for( i = 0; i < BLOOM_HASHES; ++i, h1 += h2 )
+	{
+		bit = h1 & bloom->mask;
+		atomic_fetch_or_explicit( bloom->bits + bit / 32, 1u << bit % 32, memory_order_relaxed );
+	}
+
+	atomic_fetch_add_explicit( &bloom->count, 1, memory_order_relaxed );
+}
+
+int bloom_maybe( const bloom_t* bloom, const char* login )
+{
+	unsigned h1, h2, bit;
+	int i;
+
+	if( !bloom_key( login, &h1, &h2 ) )
+		return 1;
+
+	for( i = 0; i < BLOOM_HASHES; ++i, h1 += h2 )
+	{
+		bit = h1 & bloom->mask;
+
+		if( !( atomic_load_explicit( ( atomic_uint * )bloom->bits + bit / 32, memory_order_relaxed ) & 1u << bit % 32 ) )
+			return 0;
+	}
+
+	return 1;
+}
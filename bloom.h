@@ -0,0 +1,28 @@
+#ifndef BLOOM_H
+#define BLOOM_H
+
+#include <stdatomic.h>
+#include "epoch.h"
+
+#define BLOOM_MIN_CAPACITY		65536
+#define BLOOM_BITS_PER_KEY		10		// about 1% false positives
+#define BLOOM_HASHES			7
+
+// bloom filter of known logins. bits are only set, so login is added to published filter
+// with atomic or, while work threads read it. rebuild makes new filter, old one is retired through epoch
+typedef struct bloom_s
+{
+	epoch_node_t			retired;
+	unsigned				mask;		// bits - 1
+	unsigned				capacity;	// keys before false positives grow
+	atomic_uint				count;
+	unsigned				last_id;	// biggest user id in filter, for incremental load
+	atomic_uint				bits[1];
+} bloom_t;
+
+bloom_t* bloom_create( unsigned capacity );
+void bloom_free( bloom_t* bloom );
+void bloom_add( bloom_t* bloom, const char* login );
+int bloom_maybe( const bloom_t* bloom, const char* login ); // 0 if login is surely not added
+
+#endif // BLOOM_H
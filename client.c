@@ -5,11 +5,13 @@
 #include <time.h>
 
 #include "client.h"
-#include "client_list.h"
-#include "atomic_list.h"
+#include "ip_table.h"
+#include "epoch.h"
 #include "database.h"
 #include "protocol.h"
 #include "servers.h"
+#include "session.h"
+#include "creds.h"
 #include "const.h"
 #include "util.h"
 #include "mem.h"
@@ -17,91 +19,202 @@
 #include "net.h"
 #include "dbg.h"
 
+static atomic_int client_evictions;
+
 const client_t* client_find( const struct net_clients_s clients, ip_t ip )
 {
-	const atomic_list_t*	list;
-	const client_t*			cl;
+	client_t* cl;
 
-	for( list = clients.lists; list < clients.end; ++list )
+	// mark for eviction clock, only if not marked yet to not dirty cache line of other thread
+	if( ( cl = ( client_t * )ip_table_find( clients.table, ip ) ) != NULL && !atomic_load_explicit( &cl->referenced, memory_order_relaxed ) )
+		atomic_store_explicit( &cl->referenced, true, memory_order_relaxed );
+
+	return cl;
+}
+
+int client_evicted()
+{
+	return atomic_load( &client_evictions );
+}
+
+// runs in owner thread from epoch_reclaim, arg is ntl. player could be set after removal by other thread
+static void client_reclaim( epoch_node_t* node, void* arg )
+{
+	client_t*	cl;
+	ntl_t*		ntl;
+	player_t	*player, *next;
+
+	cl	= CONTAINER_OF( node, client_t, retired );
+	ntl	= ( ntl_t * )arg;
+
+	for( player = ( player_t * )atomic_load( &cl->players ); player; player = next )
 	{
-		cl = al_head( list );
+		next = player->next;
 
-		if( cl->ip == ip )
-		{
-			return al_head_valid( list ) ? cl : NULL;
-		}
+		// player could log in again from other ip, then whitelist is for new session
+		if( session_remove( ntl->sessions, player->name, player->server, cl->ip ) )
+			server_command( ntl->servers + player->server, "whitelist remove %s", player->name );
 
-		while( cl = al_next( cl ), cl )
-		{
-			if( cl->ip == ip )
-				return cl;
-		}
+		mem_free_player( player );
 	}
 
-	return NULL;
+	mem_free_client( cl );
 }
 
-void client_add( atomic_list_t* list, unsigned ip )
+// runs in owner thread from timer_advance, arg is ntl
+static void client_expire( timer_node_t* node, void* arg )
 {
-	client_t* cl	= mem_alloc_client();
+	client_t*	cl;
+	ntl_t*		ntl;
+	long		left;
+
+	cl	= CONTAINER_OF( node, client_t, timer );
+	ntl	= ( ntl_t * )arg;
+
+	// player connected after add, keep client for full timeout
+	if( atomic_load( &cl->players ) && ( left = cl->conntime + CONNECT_TIMEOUT - time( NULL ) ) > 0 )
+	{
+		timer_set( ntl->net->clients.wheels + cl->owner, node, left * 1000, client_expire );
+		return;
+	}
+
+	dbg( "client remove: %i.%i.%i.%i time %i now %i\n", IP_TO_ARGS( cl->ip ), cl->conntime, time( NULL ) );
+	ip_table_remove( ntl->net->clients.table, cl->slot );
+
+	// other threads can still read it after client_find
+	epoch_retire( ntl->net->clients.epoch, ntl->net->clients.limbos + cl->owner, &cl->retired, client_reclaim );
+}
+
+// clock over clients table. evicts own clients without player, which were not found since last pass
+static void client_evict( net_clients_t* clients, int thread_id )
+{
+	ip_table_t* table;
+	unsigned* hand;
+	unsigned n, size;
+	client_t* cl;
+	int evicted;
+
+	table	= clients->table;
+	hand	= clients->hands + thread_id;
+	size	= ip_table_size( table );
+
+	for( n = evicted = 0; n < CLIENT_EVICT_SCAN && evicted < CLIENT_EVICT_BATCH; ++n, *hand = ( *hand + 1 ) % size )
+	{
+		// clients of other threads can be read until quiescent state
+		if( ( cl = ( client_t * )atomic_load( ip_table_value( table, *hand ) ) ) == NULL || cl->owner != thread_id || atomic_load( &cl->players ) )
+			continue;
+
+		if( atomic_exchange( &cl->referenced, false ) )
+			continue;
+
+		dbg( "client evicted: %i.%i.%i.%i\n", IP_TO_ARGS( cl->ip ) );
+		timer_del( &cl->timer );
+		ip_table_remove( table, cl->slot );
+		epoch_retire( clients->epoch, clients->limbos + thread_id, &cl->retired, client_reclaim );
+		++evicted;
+	}
+
+	atomic_fetch_add( &client_evictions, evicted );
+}
+
+// must be called from work thread thread_id, it owns the wheel
+client_t* client_add( net_clients_t* clients, int thread_id, ip_t ip )
+{
+	client_t* cl;
+
+	// memory limit is reached, evicted clients are freed after grace period and this ip is not tracked
+	if( ( cl = mem_alloc_client() ) == NULL )
+	{
+		client_evict( clients, thread_id );
+		return NULL;
+	}
+
 	cl->ip			= ip;
-	cl->player		= NULL;
 	cl->conntime	= time( NULL );
+	atomic_init( &cl->players, 0 );
+	cl->owner		= thread_id;
+	cl->timer.pprev	= NULL;
+	atomic_init( &cl->referenced, false );
 
-	al_push( list, cl );
-	atomic_store( &list->head_valid, true );
+	// table is full around this ip, client is not tracked
+	if( ( cl->slot = ip_table_add( clients->table, ip, cl ) ) < 0 )
+	{
+		dbg( "client_add: no slot for %i.%i.%i.%i\n", IP_TO_ARGS( ip ) );
+		mem_free_client( cl );
+		return NULL;
+	}
+
+	timer_set( clients->wheels + thread_id, &cl->timer, CONNECT_TIMEOUT * 1000 / 3, client_expire );
 	dbg( "client added: %i.%i.%i.%i time %i\n", IP_TO_ARGS( ip ), cl->conntime );
+
+	return cl;
 }
 
-void clients_check_timeout( struct ntl_s* ntl, long timeout )
+// adds player to client unless it is there already. other threads can push to same client at once
+static int client_attach( client_t* cl, const char* name, int server )
 {
-	const atomic_list_t*	list;
-	const atomic_list_t*	end;
-	client_t*				prev;
-	client_t*				cl;
-	player_t*				player;
-	long					remove;
-	long					div3remove;
-
-	remove = time( NULL ) - timeout;
-	div3remove = remove / 3;
-
-	for( list = ntl->net->clients.lists, end = ntl->net->clients.end; list < end; ++list )
+	player_t* player;
+	intptr_t head;
+
+	// same player logged in again from this ip
+	for( player = ( player_t * )atomic_load( &cl->players ); player; player = player->next )
 	{
-		prev = al_head( list );
+		if( player->server == server && !strcmp( player->name, name ) )
+			return 1;
+	}
+
+	if( ( player = mem_alloc_player() ) == NULL )
+		return 0;
+
+	strcpy( player->name, name );
+	player->zt		= 0;
+	player->server	= server;
+	head			= atomic_load( &cl->players );
+
+	do
+		player->next = ( player_t * )head;
+	while( !atomic_compare_exchange_weak( &cl->players, &head, ( intptr_t )player ) );
+
+	return 1;
+}
+
+// work threads don't run yet, so wheels of all threads can be used here. expiry of restored client
+// removes whitelist entries of its sessions as it would before restart
+void client_restore( ntl_t* ntl )
+{
+	net_clients_t* clients;
+	session_t session;
+	client_t* cl;
+	int slot, n;
 
-		// check timeout for head. we can't safety remove it, only set invalid flag.
-		if( prev->conntime <= remove )
-			atomic_store( &list->head_valid, false );
+	clients = &ntl->net->clients;
 
-		// check other clients and unlink timeouted. workthreads can write only head client.
-		for( cl = al_next( prev ); cl; prev = cl, cl = al_next( prev ) )
+	for( slot = n = 0; ( slot = sessions_next( ntl->sessions, slot, &session ) ) != SESSION_NONE; ++slot )
+	{
+		// players behind one nat share client, it lives from first session
+		if( ( cl = ( client_t * )client_find( *clients, session.ip ) ) == NULL )
 		{
-			if( cl->conntime <= ( cl->player ? remove : div3remove ) )
-			{
-				dbg( "client remove: %i.%i.%i.%i time %i now %i\n", cl->ip & 0xFF000000, cl->ip & 0xFF0000, cl->ip & 0xFF00, cl->ip & 0xFF, cl->conntime, time( NULL ) );
-				al_remove( prev, cl );
-				player = cl->player;
-				mem_free_client( cl );
-
-				if( cl->player )
-				{
-					server_command( ntl->servers + player->server, "whitelist remove %s", player->name );
-					free( ( void *)player );
-				}
-			}
+			if( ( cl = client_add( clients, n++ % ntl->net->threads_count, session.ip ) ) != NULL )
+				cl->conntime = session.since;
+		}
+		else if( session.since < cl->conntime )
+			cl->conntime = session.since;
+
+		if( !cl || !client_attach( cl, session.name, session.server ) )
+		{
+			if( session_remove( ntl->sessions, session.name, session.server, session.ip ) )
+				server_command( ntl->servers + session.server, "whitelist remove %s", session.name );
 		}
 	}
 }
 
-int client_read_message( socket_t sock, msg_t* msg, ntl_t* ntl )
+// copies checked message fields to job. returns PENDING_ANSWER if job must run in database
+int client_read_message( ip_t ip, msg_t* msg, ntl_t* ntl, db_job_t* job )
 {
 	ip_t			sv_ip;
 	int				sv_port;
 	server_t*		server;
-	user_t			user;
-	const char*		hwid;
-	int				res;
+	const char		*hwid, *login, *password, *mail;
 
 	dbg( "msg begin reading: len %i\n", msg->maxsize );
 
@@ -111,80 +224,136 @@ int client_read_message( socket_t sock, msg_t* msg, ntl_t* ntl )
 		if( ( hwid = msg_get_string( msg, MAX_HWID_LEN ) ) == NULL )
 			return NO_ANSWER;
 
-		if( db_is_hwid_banned( ntl->db, hwid ) )
-			return net_send_answer( sock, ntle_you_are_banned );
-
 		if( !( sv_ip = msg_get_uint( msg, 0 ) ) || !( sv_port = msg_get_ushort( msg, 0 ) ) )
 			return NO_ANSWER;
 
 		if( !( server = server_find( ntl->servers, ntl->servers_count, sv_ip, sv_port ) ) )
-			return net_send_answer( sock, ntle_invalid_server );
-
-		user.server = server - ntl->servers;
+			return ntle_invalid_server;
 
 		if(
-			( user.login	= msg_get_string( msg, MAX_PLAYER_NAME ) ) != NULL &&
-			( user.password = msg_get_string( msg, MAX_PASS_LEN ) ) != NULL
+			( login		= msg_get_string( msg, MAX_PLAYER_NAME ) ) == NULL ||
+			( password	= msg_get_string( msg, MAX_PASS_LEN ) ) == NULL
 		  )
-		{
-			if( ( res = db_login_user( ntl->db, &user ) ) == ntle_no_error )
-			{
-				ntl_print( ntl, "%s logged in.\n", user.login );
-				client_connected( ntl, &user );
-			}
-			else
-				ntl_print( ntl, "%s login rejected.\n", user.login );
+			return NO_ANSWER;
 
-			return net_send_answer( sock, res );
-		}
+		job->type		= dj_login;
+		job->server		= server - ntl->servers;
+		job->mail[0]	= '\0';
 		break;
 
 	case ntl_register:
 		if( ( hwid = msg_get_string( msg, MAX_HWID_LEN ) ) == NULL )
 			return NO_ANSWER;
 
-		if( db_is_hwid_banned( ntl->db, hwid ) )
-			return net_send_answer( sock, ntle_you_are_banned );
-
 		if(
-			( user.login	= msg_get_string( msg, MAX_PLAYER_NAME ) ) != NULL &&
-			( user.password	= msg_get_string( msg, MAX_PASS_LEN ) ) != NULL &&
-			( user.mail		= msg_get_string( msg, MAX_EMAIL_LEN ) ) != NULL
+			( login		= msg_get_string( msg, MAX_PLAYER_NAME ) ) == NULL ||
+			( password	= msg_get_string( msg, MAX_PASS_LEN ) ) == NULL ||
+			( mail		= msg_get_string( msg, MAX_EMAIL_LEN ) ) == NULL
 		  )
-		{
-			user.hour = time( NULL ) / ( 60 * 60 );
-			user.ip = net_get_ip( sock );
+			return NO_ANSWER;
 
-			if( ( res = db_register_user( ntl->db, &user ) ) == ntle_no_error )
-				ntl_print( ntl, "New registration: login: %s email: %s.\n", user.login, user.mail );
-			
-			return net_send_answer( sock, res );
-		}
+		job->type		= dj_register;
+		job->server		= 0;
+		strcpy( job->mail, mail );
 		break;
 
 	default:
-		break;
+		return NO_ANSWER;
 	}
 
-	return NO_ANSWER;
+	// banned hwid is answered without database
+	if( db_is_banned( ntl->db, hwid ) )
+		return ntle_you_are_banned;
+
+	// strings are checked for length by msg_get_string
+	strcpy( job->hwid, hwid );
+	strcpy( job->login, login );
+	strcpy( job->password, password );
+	job->hour	= time( NULL ) / ( 60 * 60 );
+	job->ip		= ip;
+	job->ctx	= NULL;
+
+	// most of brute force goes to users which don't exist
+	if( job->type == dj_login && !db_login_exists( ntl->db, login ) )
+		return ntle_login_failed;
+
+	// repeated login with same password is verified in memory
+	if( job->type == dj_login && creds_check( ntl->creds, login, password ) )
+	{
+		job->result	= ntle_no_error;
+		job->tag	= 0;
+		return client_job_done( job, ntl );
+	}
+
+	return PENDING_ANSWER;
 }
 
-void client_connected( ntl_t* ntl, user_t* user )
+// runs in work thread of job, returns answer code
+int client_job_done( db_job_t* job, ntl_t* ntl )
 {
-	client_t* cl;
-	player_t* player;
+	user_t user;
 
-	server_command( ntl->servers + user->server, "whitelist add %s", user->login );
+	if( job->result == ntle_you_are_banned )
+		return job->result;
 
-	cl = ( client_t * )client_find( ntl->net->clients, user->ip ); // :( ,h
+	user.login	= job->login;
+	user.mail	= job->mail;
+	user.ip		= job->ip;
+	user.server	= job->server;
 
-	if( !cl ) // maybe impossible
-		return;
+	if( job->type == dj_login )
+	{
+		if( job->result == ntle_no_error )
+		{
+			creds_store( ntl->creds, job->login, job->password, job->tag );
 
-	player = ( player_t *)malloc( sizeof( player_t ) );
-	strcpy( player->name, user->login );
-	player->zt		= 0;
-	player->server	= user->server;
+			// no protocol code for login later, registration one asks client to retry too
+			if( !client_connected( ntl, &user, job->thread_id ) )
+			{
+				ntl_print( ntl, "%s login delayed, no memory for client.\n", user.login );
+				return ntle_register_later;
+			}
+
+			ntl_print( ntl, "%s logged in.\n", user.login );
+		}
+		else
+		{
+			// password could be changed, cached one is wrong now
+			ntl_print( ntl, "%s login rejected.\n", user.login );
+			creds_forget( ntl->creds, job->login );
+		}
+	}
+	else if( job->result == ntle_no_error )
+		ntl_print( ntl, "New registration: login: %s email: %s.\n", user.login, user.mail );
+
+	return job->result;
+}
+
+// runs in work thread thread_id. returns 0 if ip can't be tracked, then player gets no session
+int client_connected( ntl_t* ntl, user_t* user, int thread_id )
+{
+	client_t* cl;
+	ip_t replaced;
+
+	// client could be evicted over memory limit while login waited for database. session
+	// without client is never expired, so player without it isn't let in
+	if(
+		( cl = ( client_t * )client_find( ntl->net->clients, user->ip ) ) == NULL &&
+		( cl = client_add( &ntl->net->clients, thread_id, user->ip ) ) == NULL
+	  )
+		return 0;
+
+	// duplicate login from other ip takes session, old one is kicked
+	if( !session_add( ntl->sessions, user->login, user->server, user->ip, &replaced ) )
+		ntl_print( ntl, "no session slot for %s.\n", user->login );
+	else if( replaced != INVALID_IP && replaced != user->ip )
+	{
+		ntl_print( ntl, "%s logged in from other ip, old session kicked.\n", user->login );
+		server_command( ntl->servers + user->server, "kick %s", user->login );
+	}
+
+	server_command( ntl->servers + user->server, "whitelist add %s", user->login );
+	client_attach( cl, user->login, user->server );
 
-	cl->player = player;
+	return 1;
 }
\ No newline at end of file
@@ -3,32 +3,45 @@
 
 #include <stdatomic.h>
 #include "const.h"
+#include "timer.h"
+#include "epoch.h"
 #include "net_clients.h"
 
 typedef struct player_s
 {
-	char		name[MAX_PLAYER_NAME];
-	word		zt;
-	word		server;
+	char				name[MAX_PLAYER_NAME];
+	word				zt;
+	word				server;
+	struct player_s*	next;		// other player of same ip
 } player_t;
 
 typedef struct client_s
 {
-	ip_t		ip;
-	long		conntime;
-	player_t*	player;
-	atomic_int	next;
+	ip_t				ip;
+	long				conntime;
+	atomic_intptr_t		players;	// logged in from this ip, several behind nat. only pushed while client is live
+	int					slot;		// in clients table
+	int					owner;		// work thread of timer
+	atomic_bool			referenced;	// found since last pass of eviction clock
+	union
+	{
+		timer_node_t	timer;		// while in table
+		epoch_node_t	retired;	// after removal, until no thread can see it
+	};
 } client_t;
 
-struct atomic_list_s;
 struct user_s; 
 struct ntl_s;
 struct msg_s;
+struct db_job_s;
 
 const client_t* client_find( struct net_clients_s clients, ip_t ip);
-void client_add( struct atomic_list_s* list, ip_t ip );
-void clients_check_timeout( struct ntl_s* ntl, long timeout );
-int client_read_message( socket_t sock, struct msg_s* msg, struct ntl_s* ntl );
-void client_connected( struct ntl_s* ntl, struct user_s* user );
+client_t* client_add( struct net_clients_s* clients, int thread_id, ip_t ip ); // NULL if ip is not tracked
+void client_restore( struct ntl_s* ntl ); // clients of restored sessions, before work threads start
+int client_evicted(); // count of clients evicted over memory limit
+// returns answer code for client, NO_ANSWER for invalid message or PENDING_ANSWER for database job
+int client_read_message( ip_t ip, struct msg_s* msg, struct ntl_s* ntl, struct db_job_s* job ); // ip of connection from accept, job->thread_id is set by caller
+int client_job_done( struct db_job_s* job, struct ntl_s* ntl ); // in work thread job->thread_id
+int client_connected( struct ntl_s* ntl, struct user_s* user, int thread_id );
 
 #endif // CLIENT_H
\ No newline at end of file
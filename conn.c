@@ -0,0 +1,416 @@
+#ifndef __windows__
+#include <errno.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "protocol.h"
+#include "client.h"
+#include "const.h"
+#include "conn.h"
+#include "util.h"
+#include "database.h"
+#include "ntl.h"
+#include "net.h"
+#include "dbg.h"
+
+conn_t* conn_alloc( conn_pool_t* pool, socket_t sock, ip_t ip )
+{
+	conn_t* conn;
+
+	if( ( conn = pool->free ) != NULL )
+	{
+		pool->free = conn->next;
+		--pool->count;
+	}
+	else if( ( conn = ( conn_t * )malloc( sizeof( conn_t ) ) ) == NULL )
+	{
+		fprintf( stderr, "conn_alloc: out of memory\n" );
+		return NULL;
+	}
+
+	conn->sock			= sock;
+	conn->ip			= ip;
+	conn->events		= 0;
+	conn->done			= 0;
+	conn->keepalive		= 0;
+	conn->request_id	= 0;
+	conn->pool			= pool;
+	conn->job			= NULL;
+	conn->timer.pprev	= NULL;
+	conn->frame_len		= 0;
+	conn->len			= 0;
+	conn->out_head		= 0;
+	conn->out_len		= 0;
+
+	// open list is only for closing all on exit
+	conn->prev			= NULL;
+
+	if( ( conn->next = pool->open ) != NULL )
+		conn->next->prev = conn;
+
+	pool->open = conn;
+
+	return conn;
+}
+
+static void conn_release( conn_pool_t* pool, conn_t* conn )
+{
+	conn->next	= pool->free;
+	pool->free	= conn;
+	++pool->count;
+}
+
+void conn_free( conn_pool_t* pool, conn_t* conn )
+{
+	timer_del( &conn->timer );
+
+	if( conn->prev )
+		conn->prev->next = conn->next;
+	else
+		pool->open = conn->next;
+
+	if( conn->next )
+		conn->next->prev = conn->prev;
+
+	// database thread still writes to query, answer is dropped and connection is released by conn_job_done
+	if( conn->job )
+	{
+		conn->job->ctx = NULL;
+		return;
+	}
+
+	conn_release( pool, conn );
+}
+
+void conn_close( conn_pool_t* pool, conn_t* conn )
+{
+	net_closesocket( conn->sock );
+	conn_free( pool, conn );
+}
+
+void conn_pool_free( conn_pool_t* pool )
+{
+	conn_t* conn;
+
+	while( pool->open )
+		conn_close( pool, pool->open );
+
+	while( ( conn = pool->free ) != NULL )
+	{
+		pool->free = conn->next;
+		free( ( void *)conn );
+	}
+
+	pool->count = 0;
+}
+
+static void conn_timeout( timer_node_t* node, void* arg )
+{
+	conn_t* conn = CONTAINER_OF( node, conn_t, timer );
+
+	dbg( "connection %i timed out\n", conn->sock );
+	conn_close( conn->pool, conn );
+}
+
+void conn_deadline( conn_t* conn, unsigned msec )
+{
+	timer_set( conn->pool->wheel, &conn->timer, msec, conn_timeout );
+}
+
+int conn_recv( conn_t* conn )
+{
+	int count;
+
+	// edge triggered socket: read all, or we never get event for the rest
+	while( conn->len < sizeof conn->buf )
+	{
+		count = net_recv( conn->sock, conn->buf + conn->len, sizeof conn->buf - conn->len );
+
+		if( count > 0 )
+		{
+			conn->len += count;
+			continue;
+		}
+
+		if( count == 0 ) // closed by client
+			return cr_closed;
+
+#ifndef __windows__
+		if( errno == EINTR )
+			continue;
+
+		if( errno == EAGAIN || errno == EWOULDBLOCK )
+			return cr_drained;
+#endif
+
+		perror( "net_recv::conn_sock" );
+		return cr_closed;
+	}
+
+	// buffer is full, process messages and read again
+	return cr_full;
+}
+
+int conn_append( conn_t* conn, const char* data, int len )
+{
+	if( len > sizeof conn->buf - conn->len )
+		return 0;
+
+	memcpy( conn->buf + conn->len, data, len );
+	conn->len += len;
+
+	return 1;
+}
+
+int conn_frame( conn_t* conn, msg_t* msg )
+{
+	msg_t header;
+	int len, magic, header_len, max_len;
+
+	if( conn->len < 4 )
+		return cf_wait;
+
+	header.data			= conn->buf;
+	header.readcount	= 0;
+	header.maxsize		= conn->len;
+	magic				= msg_get_uint( &header, 0 );
+
+	switch( magic )
+	{
+	case ntl_frame:
+		header_len	= NTL_FRAME_HEADER_LEN;
+		max_len		= NTL_MAX_FRAME_LEN;
+		break;
+
+	case ntl_frame_keepalive:
+		header_len	= NTL_KEEPALIVE_HEADER_LEN;
+		max_len		= NTL_MAX_KEEPALIVE_LEN;
+		break;
+
+	default:
+		// keepalive connection can't switch back to other frames
+		if( conn->keepalive )
+			return cf_error;
+
+		// old launchers send message without frame, take it as it came
+		msg->data		= conn->buf;
+		msg->readcount	= 0;
+		msg->maxsize	= conn->len;
+		conn->frame_len	= conn->len;
+		return cf_ready;
+	}
+
+	if( conn->len < header_len )
+		return cf_wait;
+
+	if( ( len = msg_get_ushort( &header, 0 ) ) > max_len )
+	{
+		dbg( "conn_frame: too long message %i\n", len );
+		return cf_error;
+	}
+
+	if( magic == ntl_frame_keepalive )
+	{
+		conn->keepalive		= 1;
+		conn->request_id	= msg_get_uint( &header, 0 );
+	}
+	else if( conn->keepalive )
+		return cf_error;
+
+	if( conn->len < header_len + len )
+		return cf_wait;
+
+	msg->data		= conn->buf + header_len;
+	msg->readcount	= 0;
+	msg->maxsize	= len;
+	conn->frame_len	= header_len + len;
+
+	return cf_ready;
+}
+
+void conn_consume( conn_t* conn )
+{
+	// pipelined messages behind this one go to buffer start
+	conn->len -= conn->frame_len;
+	memmove( conn->buf, conn->buf + conn->frame_len, conn->len );
+	conn->frame_len = 0;
+}
+
+int conn_answer( conn_t* conn, int code )
+{
+	int answer[3], len, tail, first;
+
+	answer[0]	= ntl_answer;
+	answer[1]	= code;
+	answer[2]	= conn->request_id;
+	len			= conn->keepalive ? sizeof answer : 2 * sizeof( int );
+
+	if( conn->out_len + len > CONN_OUT_LEN )
+	{
+		fprintf( stderr, "conn_answer: output queue overflow\n" );
+		return 0;
+	}
+
+	// answer can wrap around ring end
+	tail	= ( conn->out_head + conn->out_len ) & ( CONN_OUT_LEN - 1 );
+	first	= CONN_OUT_LEN - tail < len ? CONN_OUT_LEN - tail : len;
+
+	memcpy( conn->out + tail, answer, first );
+	memcpy( conn->out, ( char *)answer + first, len - first );
+	conn->out_len += len;
+
+	return 1;
+}
+
+static int conn_complete( conn_t* conn, int answer )
+{
+	if( !conn_answer( conn, answer ) )
+		return 0;
+
+	// only keepalive connection can have next message
+	if( !conn->keepalive )
+		conn->done = 1;
+
+	return 1;
+}
+
+int conn_process( conn_t* conn, ntl_t* ntl )
+{
+	msg_t msg;
+	int answer;
+
+	// one message connection is answered already
+	if( conn->done )
+		return cp_done;
+
+	// answers go in request order, so next message waits for database
+	if( conn->job )
+		return cp_pending;
+
+	for(;;)
+	{
+		// output queue is full, client must read answers before next messages
+		if( CONN_OUT_LEN - conn->out_len < CONN_MAX_ANSWER )
+			return cp_wait;
+
+		switch( conn_frame( conn, &msg ) )
+		{
+		case cf_wait:
+			return cp_wait;
+
+		case cf_error:
+			return cp_error;
+		}
+
+		if( conn->keepalive && !ntl->net->keepalive )
+		{
+			dbg( "conn_process: keepalive disabled\n" );
+			return cp_error;
+		}
+
+		conn->query.thread_id	= conn->pool->thread_id;
+		answer					= client_read_message( conn->ip, &msg, ntl, &conn->query );
+
+#ifdef __windows__
+		// no database threads, job runs here
+		if( answer == PENDING_ANSWER )
+		{
+			db_job_run( ntl->db, &conn->query );
+			answer = client_job_done( &conn->query, ntl );
+		}
+#else
+		if( answer == PENDING_ANSWER )
+		{
+			// space for answer is checked above, it stays free until job is done
+			conn->query.ctx	= conn;
+			conn->job		= &conn->query;
+			db_submit( ntl->db, conn->job );
+
+			conn_consume( conn );
+			return cp_pending;
+		}
+#endif
+
+		if( answer == NO_ANSWER || !conn_complete( conn, answer ) )
+			return cp_error;
+
+		conn_consume( conn );
+
+		if( conn->done )
+			return cp_done;
+	}
+}
+
+conn_t* conn_job_done( db_job_t* job, ntl_t* ntl )
+{
+	conn_t* conn;
+	int answer;
+
+	conn		= CONTAINER_OF( job, conn_t, query );
+	answer		= client_job_done( job, ntl );
+	conn->job	= NULL;
+
+	// job comes back to work thread of connection, so its pool can be used
+	if( !job->ctx )
+	{
+		conn_release( conn->pool, conn );
+		return NULL;
+	}
+
+	conn_complete( conn, answer );
+
+	return conn;
+}
+
+int conn_flush( conn_t* conn )
+{
+	net_buf_t bufs[2];
+	int count, sent;
+
+	if( !conn->out_len )
+		return cw_done;
+
+	// wrapped queue goes as two buffers in one syscall
+	count = 1;
+	bufs[0].data	= conn->out + conn->out_head;
+	bufs[0].len		= conn->out_len;
+
+	if( conn->out_head + conn->out_len > CONN_OUT_LEN )
+	{
+		bufs[0].len		= CONN_OUT_LEN - conn->out_head;
+		bufs[1].data	= conn->out;
+		bufs[1].len		= conn->out_len - bufs[0].len;
+		count			= 2;
+	}
+
+	if( ( sent = net_sendv( conn->sock, bufs, count ) ) < 0 )
+	{
+#ifndef __windows__
+		if( errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR )
+			return cw_again;
+#endif
+		dbg( "conn_flush: send error on %i\n", conn->sock );
+		return cw_error;
+	}
+
+	conn_out_advance( conn, sent );
+
+	// short write means kernel buffer is full
+	return conn->out_len ? cw_again : cw_done;
+}
+
+int conn_out_chunk( conn_t* conn, const char** data )
+{
+	*data = conn->out + conn->out_head;
+	return conn->out_head + conn->out_len > CONN_OUT_LEN ? CONN_OUT_LEN - conn->out_head : conn->out_len;
+}
+
+void conn_out_advance( conn_t* conn, int len )
+{
+	conn->out_len -= len;
+
+	// empty queue starts from beginning, so next answers are contiguous
+	conn->out_head = conn->out_len ? ( conn->out_head + len ) & ( CONN_OUT_LEN - 1 ) : 0;
+}
\ No newline at end of file
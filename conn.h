@@ -0,0 +1,98 @@
+#ifndef CONN_H
+#define CONN_H
+
+#include "const.h"
+#include "timer.h"
+#include "database.h"
+#ifdef HAVE_IO_URING
+#include <linux/time_types.h>
+#endif
+
+enum conn_recv_e
+{
+	cr_closed,		// closed by client or error
+	cr_drained,		// all data readed, socket returned EAGAIN
+	cr_full			// buffer is full, socket can have more data
+};
+
+enum conn_frame_e
+{
+	cf_wait,		// need more data
+	cf_ready,		// full message in buffer
+	cf_error		// broken or too long message
+};
+
+enum conn_process_e
+{
+	cp_wait,		// all messages answered (or output is full), wait for next
+	cp_done,		// one message connection answered, close after send
+	cp_pending,		// answer waits for database, connection is resumed by conn_job_done
+	cp_error		// close connection
+};
+
+enum conn_write_e
+{
+	cw_done,		// output queue is empty
+	cw_again,		// kernel buffer is full, wait for EPOLLOUT
+	cw_error
+};
+
+#define CONN_OUT_LEN		256		// must be power of 2
+#define CONN_MAX_ANSWER		( 3 * sizeof( int ) )
+
+typedef struct conn_s
+{
+	socket_t		sock;
+	ip_t			ip;			// peer address from accept
+	int				events;
+	int				done;
+	int				keepalive;
+	int				request_id;
+	struct conn_s*	next;
+	struct conn_s*	prev;
+	struct conn_pool_s*	pool;
+	db_job_t*		job;		// database request in flight, points to query
+	timer_node_t	timer;		// deadline of first message or idle keepalive
+#ifdef HAVE_IO_URING
+	struct __kernel_timespec	deadline;	// io_uring loop: absolute monotonic deadline of first message
+#endif
+	int				frame_len;
+	int				len;
+	int				out_head;
+	int				out_len;
+	char			buf[MAX_MSG_LEN];
+	char			out[CONN_OUT_LEN];	// ring of answers
+	db_job_t		query;		// no allocation per request. connection closed with job in flight is reused after job is done
+} conn_t;
+
+// per thread pool of free and open connections, so no locks needed
+typedef struct conn_pool_s
+{
+	conn_t*			free;
+	int				count;
+	conn_t*			open;
+	timer_wheel_t*	wheel;		// work thread wheel for deadlines
+	int				thread_id;
+} conn_pool_t;
+
+struct msg_s;
+struct ntl_s;
+struct db_job_s;
+
+conn_t* conn_alloc( conn_pool_t* pool, socket_t sock, ip_t ip );
+void conn_free( conn_pool_t* pool, conn_t* conn );
+void conn_close( conn_pool_t* pool, conn_t* conn );
+void conn_pool_free( conn_pool_t* pool );
+void conn_deadline( conn_t* conn, unsigned msec ); // closes connection if no event until deadline
+int conn_recv( conn_t* conn ); // drains socket until EAGAIN or full buffer
+int conn_append( conn_t* conn, const char* data, int len );
+int conn_frame( conn_t* conn, struct msg_s* msg );
+void conn_consume( conn_t* conn );
+int conn_answer( conn_t* conn, int code );
+int conn_process( conn_t* conn, struct ntl_s* ntl ); // answers all buffered messages
+conn_t* conn_job_done( struct db_job_s* job, struct ntl_s* ntl ); // returns connection to resume or NULL if it was closed
+int conn_flush( conn_t* conn ); // sends output queue in one syscall
+int conn_out_chunk( conn_t* conn, const char** data );
+void conn_out_advance( conn_t* conn, int len );
+
+#endif // CONN_H
\ No newline at end of file
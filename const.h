@@ -3,9 +3,13 @@
 
 #define CONFIG_FILE				"config.xml"
 #define LOG_FILE				"ntl.log"
+#define STATE_FILE				"ntl.state"
 #define CONNECT_TIMEOUT			15
+#define KEEPALIVE_TIMEOUT		30
+#define MESSAGE_TIMEOUT			5
 
-#define NO_ANSWER				0
+#define NO_ANSWER				-1
+#define PENDING_ANSWER			-2		// answer comes from database thread
 
 #define CPU_CACHE_LINE			64
 
@@ -14,12 +18,14 @@
 #define MAX_EMAIL_LEN			31
 #define MAX_PASS_LEN			31
 #define MAX_DIGEST_LEN			31
+#define MAX_DIGEST_HEX			64		// sha256 in hex
 #define MAX_PLAYER_NAME			20
 #define	MAX_VERSION_LEN			7
 #define MAX_SERVER_NAME			127
 #define MAX_SERVER_ID			15
 #define MAX_SERVER_PASSWORD		31
 #define MAX_SRVCMD_LEN			512
+#define MAX_MSG_LEN				256
 
 #define MAX_CMDLINE_LEN			511
 #define MAX_CMDLINE_ARGS		32
@@ -30,8 +36,14 @@
 #define CONSOLE_BUFSIZE			8096
 
 #define STRING( x )				#x
+#define XSTRING( x )			STRING( x )		// expands macro before
 
 #define SQL_QUERY_MAXLEN		512
+#define SQL_CONNECTIONS			1		// per work thread
+#define SQL_PING_INTERVAL		60		// sec of idle before health check
+#define BAN_REFRESH				10		// sec between loads of new bans and users
+#define BAN_RELOAD				600		// sec between full loads of bans table
+#define LOGINS_RELOAD			600		// sec between rebuilds of known logins filter
 
 #define NTL_BANS_TABLE			"ntl_bans"
 #define NTL_USERS_TABLE			"ntl_users"
@@ -47,6 +59,22 @@
 #define SRV_CONN_TIMEOUT		1000
 
 #define MAX_EVENTS				16
+#define LISTEN_BACKLOG			1024
+#define ACCEPT_BUDGET			64
+#define CLIENTS_TABLE			65536	// slots, keep it twice more than tracked ips
+#define RATELIMIT_BUCKETS		65536	// per ip, subnets get quarter
+#define RATELIMIT_IP_RATE		20		// connections per minute
+#define RATELIMIT_IP_BURST		8
+#define RATELIMIT_SUBNET_RATE	240
+#define RATELIMIT_SUBNET_BURST	64
+#define FLOOD_SKETCH_WIDTH		16384	// counters per row
+#define FLOOD_THRESHOLD			300		// connections per window
+#define FLOOD_WINDOW			10		// sec
+#define SESSIONS_TABLE			8192	// slots, keep it twice more than online players
+#define CREDS_CACHE				4096	// verified logins kept in memory
+#define CREDS_TTL				600		// sec before login is verified by database again, changed password is seen sooner by refresh on linux
+#define CLIENT_EVICT_BATCH		16		// clients evicted when memory limit is reached
+#define CLIENT_EVICT_SCAN		4096	// max table slots looked at for them
 
 #define THREAD_TIMEOUT			400
 #define THREAD_CHECK_FREE		10
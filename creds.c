@@ -0,0 +1,391 @@
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdio.h>
+
+#include "creds.h"
+#include "servers.h"
+#include "sys.h"
+
+#define ROTL( x, b )	( ( ( x ) << ( b ) ) | ( ( x ) >> ( 64 - ( b ) ) ) )
+#define SIPROUND		do { \
+		v0 += v1; v1 = ROTL( v1, 13 ); v1 ^= v0; v0 = ROTL( v0, 32 ); \
+		v2 += v3; v3 = ROTL( v3, 16 ); v3 ^= v2; \
+		v0 += v3; v3 = ROTL( v3, 21 ); v3 ^= v0; \
+		v2 += v1; v1 = ROTL( v1, 17 ); v1 ^= v2; v2 = ROTL( v2, 32 ); \
+	} while( 0 )
+
+// siphash-2-4, mac can't be made without key even if memory is dumped
+static unsigned long long creds_siphash( const unsigned long long* key, const byte* data, unsigned len )
+{
+	unsigned long long v0, v1, v2, v3, m;
+	unsigned i, j, tail;
+
+	v0 = key[0] ^ 0x736f6d6570736575ull;
+	v1 = key[1] ^ 0x646f72616e646f6dull;
+	v2 = key[0] ^ 0x6c7967656e657261ull;
+	v3 = key[1] ^ 0x7465646279746573ull;
+
+	for( i = 0; i + 8 <= len; i += 8 )
+	{
+		for( m = 0, j = 0; j < 8; ++j )
+			m |= ( unsigned long long )data[i + j] << ( j * 8 );
+
+		v3 ^= m;
+		SIPROUND;
+		SIPROUND;
+		v0 ^= m;
+	}
+
+	for( m = ( unsigned long long )len << 56, tail = 0; i < len; ++i, ++tail )
+		m |= ( unsigned long long )data[i] << ( tail * 8 );
+
+	v3 ^= m;
+	SIPROUND;
+	SIPROUND;
+	v0 ^= m;
+	v2 ^= 0xff;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+
+	return v0 ^ v1 ^ v2 ^ v3;
+}
+
+// logins are case insensitive in database
+static unsigned creds_hash( const char* login )
+{
+	unsigned hash;
+
+	for( hash = 2166136261u; *login; ++login )
+		hash = ( hash ^ ( byte )tolower( ( byte )*login ) ) * 16777619u;
+
+	return hash;
+}
+
+static int creds_equal( const char* s, const char* login )
+{
+	for( ; *s && tolower( ( byte )*s ) == tolower( ( byte )*login ); ++s, ++login );
+
+	return *s == *login;
+}
+
+static unsigned long long creds_mac( creds_t* creds, const char* login, const char* password )
+{
+	byte data[MAX_PLAYER_NAME + MAX_PASS_LEN + 2];
+	unsigned len;
+
+	// lowercase login, so mac is bound to account
+	for( len = 0; *login; ++login )
+		data[len++] = ( byte )tolower( ( byte )*login );
+
+	data[len++] = '\0';
+
+	while( *password )
+		data[len++] = ( byte )*password++;
+
+	return creds_siphash( creds->key, data, len );
+}
+
+static void creds_lock( creds_shard_t* shard )
+{
+	while( atomic_flag_test_and_set_explicit( &shard->lock, memory_order_acquire ) );
+}
+
+static void creds_unlock( creds_shard_t* shard )
+{
+	atomic_flag_clear_explicit( &shard->lock, memory_order_release );
+}
+
+static creds_shard_t* creds_shard( creds_t* creds, unsigned hash )
+{
+	return creds->shards + ( hash >> 28 ) % CREDS_SHARDS;
+}
+
+static int creds_lookup( creds_shard_t* shard, const char* login, unsigned hash )
+{
+	int i;
+
+	for( i = shard->heads[hash & shard->mask]; i != CREDS_NONE && !creds_equal( shard->entries[i].login, login ); i = shard->entries[i].next );
+
+	return i;
+}
+
+static void creds_lru_unlink( creds_shard_t* shard, int i )
+{
+	cred_t* cred = shard->entries + i;
+
+	if( cred->newer != CREDS_NONE )
+		shard->entries[cred->newer].older = cred->older;
+	else
+		shard->newest = cred->older;
+
+	if( cred->older != CREDS_NONE )
+		shard->entries[cred->older].newer = cred->newer;
+	else
+		shard->oldest = cred->newer;
+}
+
+static void creds_lru_push( creds_shard_t* shard, int i )
+{
+	cred_t* cred = shard->entries + i;
+
+	cred->newer	= CREDS_NONE;
+	cred->older	= shard->newest;
+
+	if( shard->newest != CREDS_NONE )
+		shard->entries[shard->newest].newer = i;
+	else
+		shard->oldest = i;
+
+	shard->newest = i;
+}
+
+// unlinks entry from its hash chain and lru
+static void creds_unlink( creds_shard_t* shard, int i )
+{
+	int* pi;
+
+	for( pi = shard->heads + ( creds_hash( shard->entries[i].login ) & shard->mask ); *pi != i; pi = &shard->entries[*pi].next );
+
+	*pi = shard->entries[i].next;
+	creds_lru_unlink( shard, i );
+}
+
+static void creds_clear( creds_shard_t* shard )
+{
+	unsigned i;
+
+	for( i = 0; i <= shard->mask; ++i )
+		shard->heads[i] = CREDS_NONE;
+
+	shard->used		= 0;
+	shard->vacant	= CREDS_NONE;
+	shard->newest	= CREDS_NONE;
+	shard->oldest	= CREDS_NONE;
+}
+
+int creds_init( creds_t* creds, int size, int ttl )
+{
+	creds_shard_t* shard;
+	unsigned n;
+	int capacity;
+
+	memset( creds, 0, sizeof( creds_t ) );
+	creds->ttl	= ttl;
+	capacity	= ( size + CREDS_SHARDS - 1 ) / CREDS_SHARDS;
+
+	if( !sys_random( creds->key, sizeof creds->key ) )
+	{
+		fprintf( stderr, "creds_init: no random for key\n" );
+		return 0;
+	}
+
+	for( n = 1; n < ( unsigned )capacity; n <<= 1 );
+
+	for( shard = creds->shards; shard < creds->shards + CREDS_SHARDS; ++shard )
+	{
+		shard->entries	= ( cred_t * )malloc( capacity * sizeof( cred_t ) );
+		shard->heads	= ( int * )malloc( n * sizeof( int ) );
+
+		if( !shard->entries || !shard->heads )
+		{
+			fprintf( stderr, "creds_init: out of memory\n" );
+			creds_free( creds );
+			return 0;
+		}
+
+		shard->mask		= n - 1;
+		shard->capacity	= capacity;
+		creds_clear( shard );
+		atomic_flag_clear( &shard->lock );
+	}
+
+	return 1;
+}
+
+void creds_free( creds_t* creds )
+{
+	creds_shard_t* shard;
+
+	for( shard = creds->shards; shard < creds->shards + CREDS_SHARDS; ++shard )
+	{
+		free( ( void *)shard->entries );
+		free( ( void *)shard->heads );
+		shard->entries	= NULL;
+		shard->heads	= NULL;
+	}
+
+	// key isn't needed after run
+	memset( creds->key, 0, sizeof creds->key );
+}
+
+int creds_check( creds_t* creds, const char* login, const char* password )
+{
+	creds_shard_t* shard;
+	unsigned long long mac;
+	unsigned hash;
+	cred_t* cred;
+	int i, valid;
+
+	hash	= creds_hash( login );
+	shard	= creds_shard( creds, hash );
+	mac		= creds_mac( creds, login, password );
+	valid	= 0;
+
+	creds_lock( shard );
+
+	if( ( i = creds_lookup( shard, login, hash ) ) != CREDS_NONE )
+	{
+		cred = shard->entries + i;
+
+		// expired entry is left for store after database answer
+		if( cred->mac == mac && cred->expires > time( NULL ) )
+		{
+			creds_lru_unlink( shard, i );
+			creds_lru_push( shard, i );
+			valid = 1;
+		}
+	}
+
+	creds_unlock( shard );
+
+	return valid;
+}
+
+void creds_store( creds_t* creds, const char* login, const char* password, unsigned long long tag )
+{
+	creds_shard_t* shard;
+	unsigned long long mac;
+	unsigned hash;
+	cred_t* cred;
+	time_t now;
+	int i;
+
+	hash	= creds_hash( login );
+	shard	= creds_shard( creds, hash );
+	mac		= creds_mac( creds, login, password );
+	now		= time( NULL );
+
+	creds_lock( shard );
+
+	if( ( i = creds_lookup( shard, login, hash ) ) != CREDS_NONE )
+	{
+		cred = shard->entries + i;
+
+		// login answered from cache keeps its expiry, database is asked again after ttl
+		if( cred->mac == mac && cred->expires > now )
+		{
+			creds_unlock( shard );
+			return;
+		}
+
+		creds_lru_unlink( shard, i );
+	}
+	else
+	{
+		// new entry from free list, unused space, or least recently used one
+		if( ( i = shard->vacant ) != CREDS_NONE )
+			shard->vacant = shard->entries[i].next;
+		else if( shard->used < shard->capacity )
+			i = shard->used++;
+		else
+			creds_unlink( shard, i = shard->oldest );
+
+		cred = shard->entries + i;
+		strncpy( cred->login, login, MAX_PLAYER_NAME );
+		cred->login[MAX_PLAYER_NAME]	= '\0';
+		cred->next						= shard->heads[hash & shard->mask];
+		shard->heads[hash & shard->mask]	= i;
+	}
+
+	cred			= shard->entries + i;
+	cred->mac		= mac;
+	cred->tag		= tag;
+	cred->expires	= now + creds->ttl;
+	creds_lru_push( shard, i );
+
+	creds_unlock( shard );
+}
+
+void creds_forget( creds_t* creds, const char* login )
+{
+	creds_shard_t* shard;
+	unsigned hash;
+	int i;
+
+	if( !login )
+	{
+		for( shard = creds->shards; shard < creds->shards + CREDS_SHARDS; ++shard )
+		{
+			creds_lock( shard );
+			creds_clear( shard );
+			creds_unlock( shard );
+		}
+
+		return;
+	}
+
+	hash	= creds_hash( login );
+	shard	= creds_shard( creds, hash );
+
+	creds_lock( shard );
+
+	if( ( i = creds_lookup( shard, login, hash ) ) != CREDS_NONE )
+	{
+		creds_unlink( shard, i );
+		shard->entries[i].next		= shard->vacant;
+		shard->entries[i].login[0]	= '\0';
+		shard->vacant				= i;
+	}
+
+	creds_unlock( shard );
+}
+
+// mysql compares digests case insensitive, so is tag
+unsigned long long creds_tag( const char* stored )
+{
+	unsigned long long hash;
+
+	for( hash = 14695981039346656037ull; *stored; ++stored )
+		hash = ( hash ^ ( byte )tolower( ( byte )*stored ) ) * 1099511628211ull;
+
+	return hash;
+}
+
+int creds_next( creds_t* creds, int pos, char* login, unsigned long long* tag )
+{
+	creds_shard_t* shard;
+	int capacity, i, found;
+
+	// all shards have same capacity
+	capacity = creds->shards[0].capacity;
+
+	for( ; pos >= 0 && pos < CREDS_SHARDS * capacity; pos = ( pos / capacity + 1 ) * capacity )
+	{
+		shard = creds->shards + pos / capacity;
+		found = 0;
+
+		creds_lock( shard );
+
+		// forgotten entries have no login
+		for( i = pos % capacity; i < shard->used; ++i )
+		{
+			if( shard->entries[i].login[0] )
+			{
+				strcpy( login, shard->entries[i].login );
+				*tag	= shard->entries[i].tag;
+				found	= 1;
+				break;
+			}
+		}
+
+		creds_unlock( shard );
+
+		if( found )
+			return pos - pos % capacity + i + 1;
+	}
+
+	return CREDS_NONE;
+}
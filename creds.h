@@ -0,0 +1,50 @@
+#ifndef CREDS_H
+#define CREDS_H
+
+#include <stdatomic.h>
+#include <time.h>
+#include "const.h"
+
+#define CREDS_SHARDS		16
+#define CREDS_NONE			-1
+
+// login verified by database. password is kept only as keyed mac, key is random for each run
+typedef struct cred_s
+{
+	char				login[MAX_PLAYER_NAME + 1];
+	unsigned long long	mac;
+	unsigned long long	tag;			// of stored password hash, other one after password change
+	time_t				expires;
+	int					next;			// hash chain, or free list
+	int					newer, older;	// lru list
+} cred_t;
+
+// logins are spread over shards by hash, each shard has own lock and lru
+typedef struct creds_shard_s
+{
+	cred_t*				entries;
+	int*				heads;
+	unsigned			mask;
+	int					capacity;
+	int					used;			// entries taken at least once
+	int					vacant;			// free list of forgotten entries
+	int					newest, oldest;
+	atomic_flag			lock;
+} creds_shard_t;
+
+typedef struct creds_s
+{
+	creds_shard_t		shards[CREDS_SHARDS];
+	unsigned long long	key[2];
+	int					ttl;
+} creds_t;
+
+int creds_init( creds_t* creds, int size, int ttl ); // size is total entries, ttl in sec
+void creds_free( creds_t* creds );
+int creds_check( creds_t* creds, const char* login, const char* password ); // 1 if same password was verified within ttl
+void creds_store( creds_t* creds, const char* login, const char* password, unsigned long long tag ); // after login accepted by database
+void creds_forget( creds_t* creds, const char* login ); // NULL forgets all, for password changes and bans
+unsigned long long creds_tag( const char* stored ); // tag of password hash as stored in database
+int creds_next( creds_t* creds, int pos, char* login, unsigned long long* tag ); // copies entry from pos, returns pos after it or CREDS_NONE
+
+#endif // CREDS_H
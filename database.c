@@ -1,8 +1,20 @@
+#ifndef __windows__
+#define _GNU_SOURCE
+#endif
 #include <mysql.h>
+#include <errmsg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <stdarg.h>
+#include <time.h>
+#include <ctype.h>
+#ifndef __windows__
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
 
 #include "const.h"
 #include "database.h"
@@ -10,6 +22,11 @@
 #include "protocol.h"
 #include "util.h"
 #include "ntl.h"
+#include "bans.h"
+#include "bloom.h"
+#include "creds.h"
+#include "timer.h"
+#include "dbg.h"
 
 #ifdef _MSC_VER
 #pragma comment( lib, "libmysql.lib" );
@@ -24,263 +41,1470 @@ typedef enum db_type_e
 	db_xenforo
 } db_type_t;
 
+// prepared once per connection, only statements of configured db type
+enum db_stmt_e
+{
+	ds_bans,
+	ds_login,
+	ds_register_check,
+	ds_insert,
+	ds_xf_user,
+	ds_xf_auth,
+	ds_count
+};
+
+static const char* db_stmt_sql[ds_count] =
+{
+	"SELECT `id`, `hwid` FROM `" NTL_BANS_TABLE "` WHERE `id`>? ORDER BY `id`",
+	"SELECT 1 FROM `" NTL_USERS_TABLE "` WHERE `login`=? AND `password`=? LIMIT 1",
+	"SELECT `login`, `hour` FROM `" NTL_USERS_TABLE "` WHERE `login`=? OR `email`=? OR ( `ip`=? AND `hour`=? ) LIMIT 1",
+	"INSERT INTO `" NTL_USERS_TABLE "` ( `login`, `password`, `email`, `ip`, `hour` ) VALUES ( ?, ?, ?, ?, ? )",
+	// `xf_user` = { `user_id` INT(10) UNSIGNED NOT NULL AUTO_INCREMENT, `username` VARCHAR(50) NOT NULL, ... } : PRIMARY KEY (`user_id`), UNIQUE KEY `username`;
+	"SELECT `user_id` FROM `" XF_USERS_TABLE "` WHERE `username`=?",
+	"SELECT `data` FROM `" XF_PASSWORDS_TABLE "` WHERE `user_id`=?"
+};
+
+#define DB_LOGINS_PENDING		64
+#define DB_LOGINS_OVERLAP		256		// ids read again by each load, rows of longer transactions can commit after bigger id
+#define DB_FLIGHTS				256		// buckets of in flight logins
+#define DB_BATCH_MAX			32		// logins in one query
+
+#ifndef __windows__
+// finished jobs of one work thread, eventfd wakes its event loop
+typedef struct db_done_s
+{
+	pthread_mutex_t		lock;
+	db_job_t*			head;		// last finished first
+	int					event_fd;
+} db_done_t;
+#endif
+
+// mysql handle is used only by one thread: its database thread, or work thread on windows
+typedef struct db_conn_s
+{
+	MYSQL*				mysql;
+	MYSQL_STMT*			stmts[ds_count];
+	struct db_s*		db;
+	time_t				last_used;
+	unsigned			error;		// errno of last failed statement
+#ifndef __windows__
+	pthread_t			thread;
+	int					started;
+#endif
+} db_conn_t;
+
 struct db_s
 {
-	MYSQL*		mysql;
 	db_type_t	type;
 	void		( *hash )( const char *, byte *);
 	char		salt[MAX_SALT_LEN];
+
+	// kept for reconnect
+	char		host[XML_MAXLEN + 1];
+	char		user[XML_MAXLEN + 1];
+	char		password[XML_MAXLEN + 1];
+	char		database[XML_MAXLEN + 1];
+	int			port;
+
+	db_conn_t*	conns;
+	int			conns_count;
+#ifndef __windows__
+	// database threads take jobs from one queue, work threads only queue them
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;
+	db_job_t*			jobs_head;
+	db_job_t*			jobs_tail;
+	int					stop;
+	db_done_t*			done;
+	int					done_count;
+	db_job_t*			flights[DB_FLIGHTS];	// queued and running logins, same one is run once
+	int					login_batch;	// usec to collect logins for one query, 0 is off
+#endif
+
+	// banned hwids, checked by work threads without query. refresh publishes new set
+	atomic_intptr_t		bans;
+	db_conn_t			refresh_conn;
+	epoch_t*			epoch;
+	epoch_limbo_t		limbo;
+	int					ban_refresh;	// sec between loads of new bans
+	int					ban_reload;		// sec between full loads, which see removed bans
+	time_t				bans_loaded;
+
+	// known logins, login of unknown user is rejected without query
+	atomic_intptr_t		logins;
+	int					logins_reload;	// sec between rebuilds, which see removed and renamed users
+	time_t				logins_loaded;
+	atomic_llong		logins_synced;	// time of last load of new rows, 0 if miss of filter isn't sure
+
+	// cached logins, dropped by refresh when stored password changed
+	creds_t*			creds;
+#ifndef __windows__
+	pthread_cond_t		refresh_cond;
+	pthread_t			refresh_thread;
+	int					refresh_started;
+
+	// logins registered while rebuild streams table, they go to new filter too
+	pthread_mutex_t		logins_lock;
+	int					logins_building;
+	int					logins_pending_count;
+	char				logins_pending[DB_LOGINS_PENDING][MAX_PLAYER_NAME + 1];
+#endif
 };
 
-struct db_s* db_init( struct xml_s* cfg )
+static void db_unprepare( db_conn_t* conn )
 {
-	struct db_s* db;
-	MYSQL* mysql;
-	const char *sql_host, *sql_user, *sql_password, *sql_database, *sql_type;
-	const char *password_hash, *password_salt;
-	int sql_port, type;
+	int i;
 
-	GET_AND_CHECK_STRING( sql_host )
-	GET_AND_CHECK_STRING( sql_user )
-	GET_AND_CHECK_STRING( sql_password )
-	GET_AND_CHECK_STRING( sql_database )
-	GET_AND_CHECK_INT( sql_port )
-	GET_AND_CHECK_STRING( sql_type )
-	GET_AND_CHECK_STRING( password_hash )
-	GET_AND_CHECK_STRING( password_salt )
-	
-	mysql = mysql_init( NULL );
+	for( i = 0; i < ds_count; ++i )
+	{
+		if( conn->stmts[i] )
+			mysql_stmt_close( conn->stmts[i] );
+
+		conn->stmts[i] = NULL;
+	}
+}
+
+static int db_prepare( db_conn_t* conn )
+{
+	int i, first, last;
 
-	if( !mysql )
+	if( conn->db->type == db_default )
 	{
-		fprintf( stderr, "Can't init MySQL lib\n" );
-		return NULL;
+		first	= ds_bans;
+		last	= ds_insert;
 	}
-	
-#ifndef NDEBUG
-	printf( "Warning: MySQL runned without connect\n" );
-#else
-	if( !mysql_real_connect( mysql, sql_host, sql_user, sql_password, sql_database, sql_port, NULL, 0 ) )
+	else
 	{
-		fprintf( stderr, "Error connecting MySQL: %s\n", mysql_error(mysql));
-		return NULL;
+		first	= ds_xf_user;
+		last	= ds_xf_auth;
 	}
-#endif
 
-	if( !strcmp( sql_type, "xenforo" ) )
-		type = db_xenforo;
-	else
+	for( i = first; i <= last; ++i )
+	{
+		if(
+			( conn->stmts[i] = mysql_stmt_init( conn->mysql ) ) == NULL ||
+			mysql_stmt_prepare( conn->stmts[i], db_stmt_sql[i], strlen( db_stmt_sql[i] ) )
+		  )
+		{
+			fprintf( stderr, "Can't prepare statement %i: %s\n", i, mysql_error( conn->mysql ) );
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static int db_connect( db_conn_t* conn )
+{
+	struct db_s* db = conn->db;
+
+	db_unprepare( conn );
+
+	if( conn->mysql )
+		mysql_close( conn->mysql );
+
+	if( ( conn->mysql = mysql_init( NULL ) ) == NULL )
 	{
-		type = db_default;
+		fprintf( stderr, "Can't init MySQL lib\n" );
+		return 0;
+	}
+
+	conn->last_used = time( NULL );
 
 #ifdef NDEBUG
-		mysql_query( mysql, "CREATE TABLE IF NOT EXISTS " NTL_BANS_TABLE " (hwid TEXT(" STRING( MAX_HWID_LEN ) "))" );
-		mysql_query( mysql, "CREATE TABLE IF NOT EXISTS " NTL_USERS_TABLE " (login TEXT(" STRING( MAX_PLAYER_NAME ) ") NOT NULL, password TEXT(" STRING( MAX_PASSWORD_LEN ) ") NOT NULL, email TEXT(" STRING( MAX_EMAIL_LEN ) ") NOT NULL, ip INTEGER, hour INTEGER )" );
-#endif
+	if( !mysql_real_connect( conn->mysql, db->host, db->user, db->password, db->database, db->port, NULL, 0 ) )
+	{
+		fprintf( stderr, "Error connecting MySQL: %s\n", mysql_error( conn->mysql ) );
+		return 0;
 	}
 
-	db = ( struct db_s * )malloc( sizeof( struct db_s ) );
-	db->hash = get_hash_func( password_hash );
-	db->mysql = mysql;
-	db->type = type;
-	strncpy( db->salt, password_salt, sizeof db->salt - 1 );
-	printf( "Connected to database %s\n", sql_database );
+	// statements need tables
+	if( db->type == db_default )
+	{
+		mysql_query( conn->mysql, "CREATE TABLE IF NOT EXISTS `" NTL_BANS_TABLE "` ( `id` INT UNSIGNED NOT NULL AUTO_INCREMENT, `hwid` VARCHAR(" XSTRING( MAX_HWID_LEN ) ") NOT NULL, "
+			"PRIMARY KEY (`id`), KEY `hwid` (`hwid`) )" );
+		// bans table of old versions has no id, new bans are loaded by it. fails if column exists
+		mysql_query( conn->mysql, "ALTER TABLE `" NTL_BANS_TABLE "` ADD COLUMN `id` INT UNSIGNED NOT NULL AUTO_INCREMENT PRIMARY KEY FIRST" );
+		mysql_query( conn->mysql, "CREATE TABLE IF NOT EXISTS `" NTL_USERS_TABLE "` ( `login` VARCHAR(" XSTRING( MAX_PLAYER_NAME ) ") NOT NULL, `password` VARCHAR(" XSTRING( MAX_DIGEST_HEX ) ") NOT NULL, "
+			"`email` VARCHAR(" XSTRING( MAX_EMAIL_LEN ) ") NOT NULL, `ip` INT UNSIGNED, `hour` INT, `id` INT UNSIGNED NOT NULL AUTO_INCREMENT, "
+			"PRIMARY KEY (`login`), UNIQUE KEY `id` (`id`), KEY `email` (`email`), KEY `ip_hour` (`ip`, `hour`) )" );
+		// users table of old versions has no id, users added by site or other servers are loaded by it. fails if column exists
+		mysql_query( conn->mysql, "ALTER TABLE `" NTL_USERS_TABLE "` ADD COLUMN `id` INT UNSIGNED NOT NULL AUTO_INCREMENT UNIQUE" );
+	}
 
-	return db;
+	return db_prepare( conn );
+#else
+	return 1;
+#endif
 }
 
-void db_close( struct db_s* db )
+static int db_conn_lost( db_conn_t* conn )
 {
-	if( db )
+	unsigned err = conn->error ? conn->error : mysql_errno( conn->mysql );
+
+	return err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST;
+}
+
+static void db_conn_check( db_conn_t* conn )
+{
+	time_t now = time( NULL );
+
+	// server closes idle connections by wait_timeout, check before use
+	if( now - conn->last_used >= SQL_PING_INTERVAL && mysql_ping( conn->mysql ) )
 	{
-		mysql_close( db->mysql );
-		free( ( void *)db );
+		dbg( "db_conn_check: ping failed, reconnecting\n" );
+		db_connect( conn );
 	}
+
+	conn->last_used	= now;
+	conn->error		= 0;
 }
 
-static MYSQL_RES* db_query( struct db_s* db, const char* fmt, ... )
+static void db_run( db_conn_t* conn, db_job_t* job );
+
+// runs job with health check before and one reconnect if server was lost during it.
+// only login is run again, insert of lost registration could be committed already
+static void db_conn_run( db_conn_t* conn, db_job_t* job )
 {
-	char query[SQL_QUERY_MAXLEN];
-	va_list argptr;
-	MYSQL_RES* result;
-	int len;
+	db_conn_check( conn );
+	db_run( conn, job );
+
+	if( db_conn_lost( conn ) )
+	{
+		dbg( "db_conn_run: connection lost, reconnecting\n" );
+
+		if( job->type != dj_login )
+			job->result = ntle_register_later;
+
+		if( db_connect( conn ) && job->type == dj_login )
+			db_run( conn, job );
+	}
+}
+
+#ifndef __windows__
+// login result depends only on login and password
+static unsigned db_flight_key( const db_job_t* job )
+{
+	const char* s;
+	unsigned hash;
+
+	for( hash = 2166136261u, s = job->login; *s; ++s )
+		hash = ( hash ^ ( byte )*s ) * 16777619u;
+
+	for( hash = ( hash ^ 0xff ) * 16777619u, s = job->password; *s; ++s )
+		hash = ( hash ^ ( byte )*s ) * 16777619u;
 
-	va_start( argptr, fmt );
-	len = vsnprintf( query, sizeof query, fmt, argptr );
-	va_end( argptr );
+	return hash;
+}
 
-	mysql_real_query( db->mysql, query, len );
-	result = mysql_store_result( db->mysql );
+// db->lock is held. returns in flight job with same login and password
+static db_job_t* db_flight_find( struct db_s* db, const db_job_t* job )
+{
+	db_job_t* flight;
 
-	if( mysql_num_rows( result ) )
+	for( flight = db->flights[job->key % DB_FLIGHTS]; flight; flight = flight->flight_next )
 	{
-		return result;
+		if( flight->key == job->key && !strcmp( flight->login, job->login ) && !strcmp( flight->password, job->password ) )
+			break;
 	}
 
-	mysql_free_result( result );
-	return NULL;
+	return flight;
 }
 
-int db_user_exist( struct db_s* db, user_t* user )
+// db->lock is held
+static void db_flight_remove( struct db_s* db, db_job_t* job )
 {
-	MYSQL_RES* result;
-	int res;
+	db_job_t** pflight;
+
+	for( pflight = db->flights + job->key % DB_FLIGHTS; *pflight != job; pflight = &( *pflight )->flight_next );
+
+	*pflight = job->flight_next;
+}
+
+// gives job back to its work thread
+static void db_done_push( struct db_s* db, db_job_t* job )
+{
+	db_done_t* done;
+	uint64_t one;
+
+	done	= db->done + job->thread_id;
+	one		= 1;
+
+	pthread_mutex_lock( &done->lock );
+	job->next	= done->head;
+	done->head	= job;
+	pthread_mutex_unlock( &done->lock );
+
+	if( write( done->event_fd, &one, sizeof one ) != sizeof one )
+		perror( "db_done_push::write" );
+}
+
+static int db_login_batch( db_conn_t* conn, db_job_t** jobs, int count );
+static int db_creds_sweep( struct db_s* db, int full );
+
+// runs logins of batch in one query, or one by one if it failed
+static void db_conn_batch( db_conn_t* conn, db_job_t** jobs, int count )
+{
+	int i;
 
-	switch( db->type )
+	db_conn_check( conn );
+
+	if( db_login_batch( conn, jobs, count ) )
+		return;
+
+	if( db_conn_lost( conn ) )
 	{
-	case db_default:
-		result = db_query( db, "SELECT COUNT(*) AS NUM FROM `" NTL_USERS_TABLE "` WHERE `login`='%s' OR `mail`='%s'", user->login, user->mail );
-		break;
+		dbg( "db_conn_batch: connection lost, reconnecting\n" );
 
-	case db_xenforo:
-		// `xf_user` = { `user_id` INT(10) UNSIGNED NOT NULL AUTO_INCREMENT, `username` VARCHAR(50) NOT NULL, ... } : PRIMARY KEY (`user_id`), UNIQUE KEY `username`;
-		result = db_query( db, "SELECT `user_id` FROM `" XF_USERS_TABLE "` WHERE `username`='%s'", user->login );
+		if( db_connect( conn ) && db_login_batch( conn, jobs, count ) )
+			return;
 	}
 
-	if( result )
+	for( i = 0; i < count; ++i )
+		db_conn_run( conn, jobs[i] );
+}
+
+// db->lock is held. takes logins from queue head until batch is full or window is over
+static int db_batch_collect( struct db_s* db, db_job_t** batch, int count )
+{
+	struct timespec deadline;
+	db_job_t* job;
+
+	clock_gettime( CLOCK_REALTIME, &deadline );
+	deadline.tv_nsec += db->login_batch * 1000L;
+	deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+	deadline.tv_nsec %= 1000000000L;
+
+	while( count < DB_BATCH_MAX && !db->stop )
 	{
-		res = atoi( mysql_fetch_row( result )[0] );
-		mysql_free_result( result );
-		return res;
+		if( ( job = db->jobs_head ) == NULL )
+		{
+			if( pthread_cond_timedwait( &db->cond, &db->lock, &deadline ) == ETIMEDOUT )
+				break;
+
+			continue;
+		}
+
+		// registration is left for other thread, its signal could be taken by this one
+		if( job->type != dj_login )
+		{
+			pthread_cond_signal( &db->cond );
+			break;
+		}
+
+		if( ( db->jobs_head = job->next ) == NULL )
+			db->jobs_tail = NULL;
+
+		batch[count++] = job;
 	}
 
-	return 0;
+	return count;
 }
 
-int db_is_hwid_banned( struct db_s* db, const char* hwid )
+// gives job and jobs of same login which came while it was in flight back to their work threads
+static void db_job_finish( struct db_s* db, db_job_t* job )
 {
-	MYSQL_RES* result;
-	int res;
+	db_job_t* next;
 
-	if( db->type != db_default )
-		return 0;
+	if( job->type == dj_login )
+	{
+		pthread_mutex_lock( &db->lock );
+		db_flight_remove( db, job );
+		pthread_mutex_unlock( &db->lock );
+	}
 
-	result = db_query( db, "SELECT COUNT(*) AS NUM FROM `" NTL_BANS_TABLE "` WHERE `hwid`='%s'", hwid );
-	
-	if( result )
+	for( next = job->followers; next; next = next->followers )
 	{
-		res = mysql_fetch_row( result )[0][0] != '0';
-		mysql_free_result( result );
-		return res;
+		next->result	= job->result;
+		next->tag		= job->tag;
 	}
 
-	return 0;
+	for( ; job; job = next )
+	{
+		next = job->followers;
+		db_done_push( db, job );
+	}
 }
 
-int db_register_user( struct db_s* db, user_t* user )
+static void* db_thread( void* arg )
 {
-	MYSQL_RES* result;
-	MYSQL_ROW row;
-	user_t db_user;
-	int res, len;
-	char insert[SQL_QUERY_MAXLEN];
+	db_conn_t* conn;
+	struct db_s* db;
+	db_job_t *job, *batch[DB_BATCH_MAX];
+	int count, i;
 
-	if( db->type != db_default )
-		return ntle_register_disabled;
+	conn	= ( db_conn_t * )arg;
+	db		= conn->db;
 
-	// check if already exist
-	result = db_query( db, "SELECT login, hour FROM `" NTL_USERS_TABLE "` WHERE `login`='%s' OR `mail`='%s' OR ( `ip`='%i' and `hour`='%i' )", user->login, user->mail, user->ip, user->hour );
+	// client library keeps per thread state
+	mysql_thread_init();
 
-	if( result )
+	for(;;)
 	{
-		row = mysql_fetch_row( result );
-		db_user.login = row[0];
-		db_user.hour = atoi( row[1] );
+		pthread_mutex_lock( &db->lock );
+
+		while( !db->jobs_head && !db->stop )
+			pthread_cond_wait( &db->cond, &db->lock );
+
+		if( ( job = db->jobs_head ) == NULL )
+		{
+			pthread_mutex_unlock( &db->lock );
+			break;
+		}
+
+		if( ( db->jobs_head = job->next ) == NULL )
+			db->jobs_tail = NULL;
+
+		batch[0]	= job;
+		count		= 1;
 
-		if( !strcmp( user->login, db_user.login ) )
-			res = ntle_login_exist;
-		else if( user->hour == db_user.hour ) 
-			res = ntle_register_later;
+		// logins coming within batch window go to one query
+		if( db->login_batch && db->type == db_default && job->type == dj_login )
+			count = db_batch_collect( db, batch, count );
+
+		pthread_mutex_unlock( &db->lock );
+
+		if( count > 1 )
+			db_conn_batch( conn, batch, count );
 		else
-			res = ntle_email_exist;
-	}
-	else
-	{
-		len = snprintf( insert, sizeof insert, "INSERT INTO `" NTL_USERS_TABLE "` VALUES ( '%s', '%s', '%s', '%i', '%i' )", user->login, user->mail, user->password, user->ip, user->hour );
-		mysql_real_query( db->mysql, insert, len );
-		res = ntle_no_error;
+			db_conn_run( conn, job );
+
+		for( i = 0; i < count; ++i )
+			db_job_finish( db, batch[i] );
 	}
 
-	mysql_free_result( result );
-	return res;
+	mysql_thread_end();
+	return NULL;
 }
 
-int db_login_user( struct db_s* db, user_t* user )
+static int db_start( struct db_s* db, int threads_count )
 {
-	char query[SQL_QUERY_MAXLEN];
-	char salted_pass[MAX_PASS_LEN + MAX_SALT_LEN + 1];
-	byte hashed_pass[32], hashed_salt[32];
-	MYSQL_RES* result;
-	MYSQL_ROW row;
-	int len, res;
-	const char* xf_user_id;
-	char xf_hash[64], xf_salt[16], xf_hash_func[8];
-	hash_func_t hash_func;
+	db_conn_t* conn;
+	int i;
 
-	res = 0;
+	pthread_mutex_init( &db->lock, NULL );
+	pthread_cond_init( &db->cond, NULL );
+	pthread_cond_init( &db->refresh_cond, NULL );
+	pthread_mutex_init( &db->logins_lock, NULL );
+	db->jobs_head	= db->jobs_tail = NULL;
+	db->stop		= 0;
+	db->done_count	= threads_count;
+	db->done		= ( db_done_t * )calloc( threads_count, sizeof( db_done_t ) );
 
-	if( db->type == db_default )
+	for( i = 0; i < threads_count; ++i )
 	{
-		if( db->hash )
+		pthread_mutex_init( &db->done[i].lock, NULL );
+
+		if( ( db->done[i].event_fd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC ) ) == -1 )
 		{
-			if( db->salt[0] )
-			{
-				strcpy( salted_pass, user->password );
-				strcat( salted_pass, db->salt );
-			
-				db->hash( salted_pass, hashed_pass );
-			}
-			else
-				db->hash( user->password, hashed_pass );
+			perror( "eventfd" );
+			return 0;
+		}
+	}
 
-			user->password = ( char *)hashed_pass;
+	// one thread per connection, so queries of all connections run in parallel
+	for( conn = db->conns; conn < db->conns + db->conns_count; ++conn )
+	{
+		if( pthread_create( &conn->thread, NULL, db_thread, conn ) )
+		{
+			fprintf( stderr, "Can't start database thread\n" );
+			return 0;
 		}
 
-		result = db_query( db, "SELECT COUNT(*) AS NUM FROM `" NTL_USERS_TABLE "` WHERE `login`='%s' and `password`='%s'", user->login, user->password );
+		conn->started = 1;
+	}
+
+	return 1;
+}
 
-		if( result )
-			res = mysql_fetch_row( result )[0][0] != '0';
-		else
-			res = 0;
+static void db_stop( struct db_s* db )
+{
+	db_conn_t* conn;
+	int i;
 
-		mysql_free_result( result );
+	pthread_mutex_lock( &db->lock );
+	db->stop = 1;
+	pthread_cond_broadcast( &db->cond );
+	pthread_cond_signal( &db->refresh_cond );
+	pthread_mutex_unlock( &db->lock );
+
+	if( db->refresh_started )
+		pthread_join( db->refresh_thread, NULL );
+
+	for( conn = db->conns; conn < db->conns + db->conns_count; ++conn )
+	{
+		if( conn->started )
+			pthread_join( conn->thread, NULL );
 	}
-	else if( db->type == db_xenforo )
+
+	// finished jobs belong to connections of stopped work threads
+	for( i = 0; i < db->done_count; ++i )
 	{
-		result = db_query( db, "SELECT `user_id` FROM `" XF_USERS_TABLE "` WHERE `username`='%s'", user->login );
+		close( db->done[i].event_fd );
+		pthread_mutex_destroy( &db->done[i].lock );
+	}
+
+	free( ( void *)db->done );
+	pthread_cond_destroy( &db->refresh_cond );
+	pthread_mutex_destroy( &db->logins_lock );
+	pthread_cond_destroy( &db->cond );
+	pthread_mutex_destroy( &db->lock );
+}
+
+void db_submit( struct db_s* db, db_job_t* job )
+{
+	db_job_t* flight;
+
+	job->next		= NULL;
+	job->followers	= NULL;
+
+	if( job->type == dj_login )
+		job->key = db_flight_key( job );
+
+	pthread_mutex_lock( &db->lock );
 
-		if( result )
+	// retried login waits for result of first one, instead of same query
+	if( job->type == dj_login )
+	{
+		if( ( flight = db_flight_find( db, job ) ) != NULL )
 		{
-			xf_user_id = mysql_fetch_row( result )[0];
-			len = snprintf( query, sizeof query, "SELECT data FROM `" XF_PASSWORDS_TABLE "` WHERE `user_id`='%s'", xf_user_id );
-			mysql_free_result( result );
+			job->followers		= flight->followers;
+			flight->followers	= job;
+			pthread_mutex_unlock( &db->lock );
+			return;
+		}
 
-			result = db_query( db, query );
+		job->flight_next					= db->flights[job->key % DB_FLIGHTS];
+		db->flights[job->key % DB_FLIGHTS]	= job;
+	}
 
-			if( result )
-			{
-				row = mysql_fetch_row( result );
-
-				if(
-					php_get_serialized( row[0], "hash", xf_hash, sizeof xf_hash - 1 ) &&
-					php_get_serialized( row[0], "salt", xf_salt, sizeof xf_salt - 1 ) &&
-					php_get_serialized( row[0], "hashFunc", xf_hash_func, sizeof xf_hash_func - 1 )
-				  )
-				{
-					// hash = sha1( sha1( pass ) + sha1( salt ) )
-					hash_func = get_hash_func( xf_hash_func );
-					hash_func( user->password, hashed_pass );
-					hash_func( xf_salt, hashed_salt );
-					strcpy( salted_pass, ( char *)hashed_pass );
-					strcat( salted_pass, ( char *)hashed_salt );
-					hash_func( salted_pass, hashed_pass );
-
-					res = !strcmp( hashed_pass, xf_hash );
-					mysql_free_result( result );
-				}
-			}
+	if( db->jobs_tail )
+		db->jobs_tail->next = job;
+	else
+		db->jobs_head = job;
+
+	db->jobs_tail = job;
+	pthread_cond_signal( &db->cond );
+	pthread_mutex_unlock( &db->lock );
+}
+
+db_job_t* db_completed( struct db_s* db, int thread_id )
+{
+	db_done_t* done;
+	db_job_t *job, *next, *list;
+	uint64_t count;
+
+	done = db->done + thread_id;
+
+	// reset counter first, job finished after it comes with next event
+	if( read( done->event_fd, &count, sizeof count ) != sizeof count )
+		return NULL;
+
+	pthread_mutex_lock( &done->lock );
+	job			= done->head;
+	done->head	= NULL;
+	pthread_mutex_unlock( &done->lock );
+
+	// stack is last finished first, reverse it
+	for( list = NULL; job; job = next )
+	{
+		next		= job->next;
+		job->next	= list;
+		list		= job;
+	}
+
+	return list;
+}
+
+int db_event_fd( struct db_s* db, int thread_id )
+{
+	return db->done[thread_id].event_fd;
+}
+#endif
+
+struct db_s* db_init( struct xml_s* cfg, int threads_count )
+{
+	struct db_s* db;
+	db_conn_t* conn;
+	const char *sql_host, *sql_user, *sql_password, *sql_database, *sql_type;
+	const char *password_hash, *password_salt;
+	int sql_port, sql_connections, ban_refresh, ban_reload, logins_reload, login_batch;
+
+	GET_AND_CHECK_STRING( sql_host )
+	GET_AND_CHECK_STRING( sql_user )
+	GET_AND_CHECK_STRING( sql_password )
+	GET_AND_CHECK_STRING( sql_database )
+	GET_AND_CHECK_INT( sql_port )
+	GET_AND_CHECK_STRING( sql_type )
+	GET_AND_CHECK_STRING( password_hash )
+	GET_AND_CHECK_STRING( password_salt )
+
+	// connections per work thread
+	if( ( sql_connections = xml_get_int( cfg, "sql_connections" ) ) <= 0 )
+		sql_connections = SQL_CONNECTIONS;
+
+	if( ( ban_refresh = xml_get_int( cfg, "ban_refresh" ) ) <= 0 )
+		ban_refresh = BAN_REFRESH;
+
+	if( ( ban_reload = xml_get_int( cfg, "ban_reload" ) ) <= 0 )
+		ban_reload = BAN_RELOAD;
+
+	if( ( logins_reload = xml_get_int( cfg, "logins_reload" ) ) <= 0 )
+		logins_reload = LOGINS_RELOAD;
+
+	// batching adds up to this delay to each login, so it is off by default
+	if( ( login_batch = xml_get_int( cfg, "login_batch" ) ) < 0 )
+		login_batch = 0;
+
+	// library init isn't thread safe, do it before any thread uses mysql
+	if( mysql_library_init( 0, NULL, NULL ) )
+	{
+		fprintf( stderr, "Can't init MySQL lib\n" );
+		return NULL;
+	}
+
+	db = ( struct db_s * )calloc( 1, sizeof( struct db_s ) );
+	db->hash = get_hash_func( password_hash );
+	db->type = strcmp( sql_type, "xenforo" ) ? db_default : db_xenforo;
+	db->port = sql_port;
+	db->ban_refresh = ban_refresh;
+	db->ban_reload = ban_reload;
+	db->logins_reload = logins_reload;
+#ifndef __windows__
+	db->login_batch = login_batch;
+#endif
+	strncpy( db->salt, password_salt, sizeof db->salt - 1 );
+	strncpy( db->host, sql_host, sizeof db->host - 1 );
+	strncpy( db->user, sql_user, sizeof db->user - 1 );
+	strncpy( db->password, sql_password, sizeof db->password - 1 );
+	strncpy( db->database, sql_database, sizeof db->database - 1 );
+
+#ifdef __windows__
+	// work threads run queries by themselves, one connection each
+	db->conns_count = threads_count;
+#else
+	db->conns_count = threads_count * sql_connections;
+#endif
+	db->conns = ( db_conn_t * )calloc( db->conns_count, sizeof( db_conn_t ) );
+
+#ifndef NDEBUG
+	printf( "Warning: MySQL runned without connect\n" );
+#endif
+
+	for( conn = db->conns; conn < db->conns + db->conns_count; ++conn )
+	{
+		conn->db = db;
+
+		if( !db_connect( conn ) )
+		{
+			db_close( db );
+			return NULL;
 		}
 	}
 
-	return res ? ntle_no_error : ntle_login_failed;
-}
\ No newline at end of file
+	printf( "Connected to database %s with %i connections\n", sql_database, db->conns_count );
+
+#ifndef __windows__
+	if( !db_start( db, threads_count ) )
+	{
+		db_close( db );
+		return NULL;
+	}
+#endif
+
+	return db;
+}
+
+void db_close( struct db_s* db )
+{
+	db_conn_t* conn;
+
+	if( db )
+	{
+#ifndef __windows__
+		if( db->done )
+			db_stop( db );
+#endif
+		// work threads are stopped, no one reads sets
+		epoch_flush( &db->limbo, NULL );
+
+		if( atomic_load( &db->bans ) )
+			bans_free( ( bans_t * )atomic_load( &db->bans ) );
+
+		if( atomic_load( &db->logins ) )
+			bloom_free( ( bloom_t * )atomic_load( &db->logins ) );
+
+		db_unprepare( &db->refresh_conn );
+
+		if( db->refresh_conn.mysql )
+			mysql_close( db->refresh_conn.mysql );
+
+		for( conn = db->conns; conn < db->conns + db->conns_count; ++conn )
+		{
+			db_unprepare( conn );
+
+			if( conn->mysql )
+				mysql_close( conn->mysql );
+		}
+
+		free( ( void *)db->conns );
+		free( ( void *)db );
+		mysql_library_end();
+	}
+}
+
+static void db_bind_string( MYSQL_BIND* bind, char* buf, unsigned long size, unsigned long* len )
+{
+	memset( bind, 0, sizeof( MYSQL_BIND ) );
+	bind->buffer_type	= MYSQL_TYPE_STRING;
+	bind->buffer		= buf;
+	bind->buffer_length	= size;
+	bind->length		= len;
+}
+
+static void db_bind_int( MYSQL_BIND* bind, void* value, int is_unsigned )
+{
+	memset( bind, 0, sizeof( MYSQL_BIND ) );
+	bind->buffer_type	= MYSQL_TYPE_LONG;
+	bind->buffer		= value;
+	bind->is_unsigned	= is_unsigned;
+}
+
+// binds params, executes and fetches first row to results. returns 1 if row exists, 0 if not or -1 on error.
+// row is read from connection buffer without storing result set, so client library allocates nothing
+static int db_execute( db_conn_t* conn, int id, MYSQL_BIND* params, MYSQL_BIND* results )
+{
+	MYSQL_STMT* stmt;
+	int row;
+
+	if( ( stmt = conn->stmts[id] ) == NULL )
+		return -1;
+
+	if(
+		( params && mysql_stmt_bind_param( stmt, params ) ) ||
+		mysql_stmt_execute( stmt ) ||
+		( results && mysql_stmt_bind_result( stmt, results ) )
+	  )
+	{
+		conn->error = mysql_stmt_errno( stmt );
+		dbg( "db_execute %i: %s\n", id, mysql_stmt_error( stmt ) );
+		return -1;
+	}
+
+	// insert has no result set
+	if( !mysql_stmt_field_count( stmt ) )
+		return 0;
+
+	// truncated string is cut by caller with its buffer size
+	switch( mysql_stmt_fetch( stmt ) )
+	{
+	case 0:
+	case MYSQL_DATA_TRUNCATED:
+		row = 1;
+		break;
+
+	case MYSQL_NO_DATA:
+		row = 0;
+		break;
+
+	default:
+		conn->error = mysql_stmt_errno( stmt );
+		dbg( "db_execute %i fetch: %s\n", id, mysql_stmt_error( stmt ) );
+		row = -1;
+	}
+
+	// rest of rows is skipped, connection must be free for next statement
+	mysql_stmt_free_result( stmt );
+	return row;
+}
+
+static void db_terminate( char* buf, unsigned long size, unsigned long len )
+{
+	buf[len < size ? len : size - 1] = '\0';
+}
+
+static void db_bans_reclaim( epoch_node_t* node, void* arg )
+{
+	bans_free( CONTAINER_OF( node, bans_t, retired ) );
+}
+
+// loads bans added after current set, or whole table if full. rows go to new set, current one
+// is read by work threads. returns 0 on error
+static int db_bans_load( struct db_s* db, int full )
+{
+	db_conn_t* conn;
+	MYSQL_STMT* stmt;
+	MYSQL_BIND param, results[2];
+	bans_t *current, *bans, *grown;
+	unsigned last_id, id;
+	unsigned long len;
+	char hwid[MAX_HWID_LEN + 1];
+	int err;
+
+	conn	= &db->refresh_conn;
+	current	= ( bans_t * )atomic_load( &db->bans );
+	last_id	= full || !current ? 0 : current->last_id;
+	bans	= NULL;
+
+	if( ( stmt = conn->stmts[ds_bans] ) == NULL )
+		return 0;
+
+	db_bind_int( &param, &last_id, 1 );
+	db_bind_int( results, &id, 1 );
+	db_bind_string( results + 1, hwid, sizeof hwid, &len );
+
+	if( mysql_stmt_bind_param( stmt, &param ) || mysql_stmt_execute( stmt ) || mysql_stmt_bind_result( stmt, results ) )
+	{
+		conn->error = mysql_stmt_errno( stmt );
+		dbg( "db_bans_load: %s\n", mysql_stmt_error( stmt ) );
+		return 0;
+	}
+
+	while( ( err = mysql_stmt_fetch( stmt ) ) == 0 || err == MYSQL_DATA_TRUNCATED )
+	{
+		db_terminate( hwid, sizeof hwid, len );
+
+		// copy is made by first new row, usually there is none
+		if( !bans )
+			bans = full || !current ? bans_create( 0 ) : bans_copy( current, current->count + 1 );
+
+		// set is full at half load
+		while( bans && !bans_add( bans, hwid ) )
+		{
+			grown = bans_copy( bans, bans->count * 2 );
+			bans_free( bans );
+			bans = grown;
+		}
+
+		if( !bans )
+			break;
+
+		bans->last_id = id;
+	}
+
+	if( err != MYSQL_NO_DATA )
+	{
+		if( bans )
+		{
+			conn->error = mysql_stmt_errno( stmt );
+			dbg( "db_bans_load fetch: %s\n", mysql_stmt_error( stmt ) );
+		}
+
+		mysql_stmt_free_result( stmt );
+		bans_free( bans );
+		return 0;
+	}
+
+	mysql_stmt_free_result( stmt );
+
+	// empty table after full load clears set
+	if( !bans && full && ( bans = bans_create( 0 ) ) == NULL )
+		return 0;
+
+	if( !bans )
+		return 1;
+
+	atomic_store( &db->bans, ( intptr_t )bans );
+
+	if( current )
+		epoch_retire( db->epoch, &db->limbo, &current->retired, db_bans_reclaim );
+
+	return 1;
+}
+
+static void db_logins_reclaim( epoch_node_t* node, void* arg )
+{
+	bloom_free( CONTAINER_OF( node, bloom_t, retired ) );
+}
+
+// streams logins to filter. full load rebuilds filter from whole table, other one adds
+// users created after last load to current filter. returns 0 on error
+static int db_logins_load( struct db_s* db, int full )
+{
+	db_conn_t* conn;
+	MYSQL_RES* res;
+	MYSQL_ROW row;
+	bloom_t *current, *bloom;
+	unsigned count, id, from;
+	char query[SQL_QUERY_MAXLEN];
+	int i, err;
+
+	conn	= &db->refresh_conn;
+	current	= ( bloom_t * )atomic_load( &db->logins );
+
+	if( !full && !current )
+		return 1;
+
+	if( full )
+	{
+		// filter size comes from row count
+		if(
+			mysql_query( conn->mysql, db->type == db_default ? "SELECT COUNT(*) FROM `" NTL_USERS_TABLE "`" : "SELECT COUNT(*) FROM `" XF_USERS_TABLE "`" ) ||
+			( res = mysql_store_result( conn->mysql ) ) == NULL
+		  )
+		{
+			dbg( "db_logins_load: %s\n", mysql_error( conn->mysql ) );
+			return 0;
+		}
+
+		row		= mysql_fetch_row( res );
+		count	= row && row[0] ? strtoul( row[0], NULL, 10 ) : 0;
+		mysql_free_result( res );
+
+		if( ( bloom = bloom_create( count * 2 ) ) == NULL )
+			return 0;
+
+#ifndef __windows__
+		pthread_mutex_lock( &db->logins_lock );
+		db->logins_building			= 1;
+		db->logins_pending_count	= 0;
+		pthread_mutex_unlock( &db->logins_lock );
+#endif
+	}
+	else
+		bloom = current;
+
+	// adding same login again changes nothing
+	from = full || current->last_id < DB_LOGINS_OVERLAP ? 0 : current->last_id - DB_LOGINS_OVERLAP;
+
+	if( db->type == db_default )
+		snprintf( query, sizeof query, "SELECT `id`, `login` FROM `" NTL_USERS_TABLE "` WHERE `id`>%u ORDER BY `id`", from );
+	else
+		snprintf( query, sizeof query, "SELECT `user_id`, `username` FROM `" XF_USERS_TABLE "` WHERE `user_id`>%u ORDER BY `user_id`", from );
+
+	// rows are read one by one, result set isn't stored
+	if( !mysql_query( conn->mysql, query ) && ( res = mysql_use_result( conn->mysql ) ) != NULL )
+	{
+		while( ( row = mysql_fetch_row( res ) ) != NULL )
+		{
+			if( !row[1] )
+				continue;
+
+			bloom_add( bloom, row[1] );
+
+			if( ( id = strtoul( row[0], NULL, 10 ) ) > bloom->last_id )
+				bloom->last_id = id;
+		}
+
+		err = mysql_errno( conn->mysql );
+		mysql_free_result( res );
+	}
+	else
+		err = mysql_errno( conn->mysql );
+
+	if( !full )
+	{
+		if( err )
+			dbg( "db_logins_load: %s\n", mysql_error( conn->mysql ) );
+
+		return !err;
+	}
+
+#ifdef __windows__
+	// filter is built once before work threads, nothing is registered during it
+	if( err )
+	{
+		dbg( "db_logins_load: %s\n", mysql_error( conn->mysql ) );
+		bloom_free( bloom );
+		return 0;
+	}
+
+	atomic_store( &db->logins, ( intptr_t )bloom );
+#else
+	pthread_mutex_lock( &db->logins_lock );
+
+	// too many registrations during rebuild, it is retried later
+	if( err || db->logins_pending_count > DB_LOGINS_PENDING )
+	{
+		db->logins_building = 0;
+		pthread_mutex_unlock( &db->logins_lock );
+
+		if( err )
+			dbg( "db_logins_load: %s\n", mysql_error( conn->mysql ) );
+
+		bloom_free( bloom );
+		return 0;
+	}
+
+	for( i = 0; i < db->logins_pending_count; ++i )
+		bloom_add( bloom, db->logins_pending[i] );
+
+	atomic_store( &db->logins, ( intptr_t )bloom );
+	db->logins_building = 0;
+	pthread_mutex_unlock( &db->logins_lock );
+#endif
+
+	if( current )
+		epoch_retire( db->epoch, &db->limbo, &current->retired, db_logins_reclaim );
+
+	return 1;
+}
+
+// login registered by server is known at once
+static void db_logins_add( struct db_s* db, const char* login )
+{
+	bloom_t* bloom;
+
+#ifndef __windows__
+	pthread_mutex_lock( &db->logins_lock );
+
+	if( db->logins_building && db->logins_pending_count++ < DB_LOGINS_PENDING )
+		strcpy( db->logins_pending[db->logins_pending_count - 1], login );
+#endif
+
+	if( ( bloom = ( bloom_t * )atomic_load( &db->logins ) ) != NULL )
+		bloom_add( bloom, login );
+
+#ifndef __windows__
+	pthread_mutex_unlock( &db->logins_lock );
+#endif
+}
+
+// runs load and retries it once on new connection if server was lost
+static int db_refresh_load( struct db_s* db, int ( *load )( struct db_s *, int ), int full )
+{
+	db_conn_t* conn = &db->refresh_conn;
+	int loaded;
+
+	db_conn_check( conn );
+
+	if( !( loaded = load( db, full ) ) && db_conn_lost( conn ) )
+	{
+		dbg( "db_refresh_load: connection lost, reconnecting\n" );
+
+		if( db_connect( conn ) )
+			loaded = load( db, full );
+	}
+
+	return loaded;
+}
+
+#ifndef __windows__
+// loads new bans and users every ban_refresh sec, whole tables every ban_reload and logins_reload sec
+static void* db_refresh_thread( void* arg )
+{
+	struct db_s* db;
+	struct timespec wake;
+	bloom_t* bloom;
+	time_t now;
+	int stop, full;
+
+	db = ( struct db_s * )arg;
+
+	mysql_thread_init();
+
+	for(;;)
+	{
+		clock_gettime( CLOCK_REALTIME, &wake );
+		wake.tv_sec += db->ban_refresh;
+
+		pthread_mutex_lock( &db->lock );
+
+		while( !db->stop && pthread_cond_timedwait( &db->refresh_cond, &db->lock, &wake ) != ETIMEDOUT );
+
+		stop = db->stop;
+		pthread_mutex_unlock( &db->lock );
+
+		if( stop )
+			break;
+
+		now = time( NULL );
+
+		if( db->type == db_default )
+		{
+			full = now - db->bans_loaded >= db->ban_reload;
+
+			if( db_refresh_load( db, db_bans_load, full ) && full )
+				db->bans_loaded = now;
+		}
+
+		// filter over its capacity has more false positives, it is rebuilt bigger
+		bloom	= ( bloom_t * )atomic_load( &db->logins );
+		full	= !bloom || atomic_load( &bloom->count ) > bloom->capacity || now - db->logins_loaded >= db->logins_reload;
+
+		if( db_refresh_load( db, db_logins_load, full ) )
+		{
+			if( full )
+				db->logins_loaded = now;
+
+			// renamed xenforo user keeps the same id, filter sees new name only after rebuild
+			if( db->type == db_default )
+				atomic_store( &db->logins_synced, now );
+		}
+
+		if( db->creds )
+			db_refresh_load( db, db_creds_sweep, 0 );
+
+		// old sets are freed when every work thread passed its loop top
+		epoch_reclaim( db->epoch, &db->limbo, NULL );
+	}
+
+	mysql_thread_end();
+	return NULL;
+}
+#endif
+
+int db_preload( struct db_s* db, struct epoch_s* epoch, struct creds_s* creds )
+{
+	bans_t* bans;
+	bloom_t* bloom;
+
+	db->epoch			= epoch;
+	db->creds			= creds;
+	db->refresh_conn.db	= db;
+
+	if( !db_connect( &db->refresh_conn ) )
+		return 0;
+
+	// not loaded set is retried by refresh with full load
+	if( db->type == db_default )
+	{
+		if( db_bans_load( db, 1 ) )
+		{
+			db->bans_loaded = time( NULL );
+
+			if( ( bans = ( bans_t * )atomic_load( &db->bans ) ) != NULL )
+				printf( "Loaded %u bans\n", bans->count );
+		}
+		else
+			fprintf( stderr, "Can't load bans\n" );
+	}
+
+	if( db_logins_load( db, 1 ) )
+	{
+		db->logins_loaded = time( NULL );
+
+		if( ( bloom = ( bloom_t * )atomic_load( &db->logins ) ) != NULL )
+			printf( "Loaded %u logins\n", atomic_load( &bloom->count ) );
+	}
+	else
+		fprintf( stderr, "Can't load logins\n" );
+
+#ifndef __windows__
+	if( pthread_create( &db->refresh_thread, NULL, db_refresh_thread, db ) )
+	{
+		fprintf( stderr, "Can't start refresh thread\n" );
+		return 0;
+	}
+
+	db->refresh_started = 1;
+#endif
+
+	return 1;
+}
+
+int db_is_banned( struct db_s* db, const char* hwid )
+{
+	bans_t* bans = ( bans_t * )atomic_load( &db->bans );
+
+	return bans && bans_find( bans, hwid );
+}
+
+int db_login_exists( struct db_s* db, const char* login )
+{
+	bloom_t* bloom = ( bloom_t * )atomic_load( &db->logins );
+	long long synced = atomic_load( &db->logins_synced );
+
+	// miss is sure only while refresh loads new rows, else database is asked. user added
+	// by site or other server is unknown for one ban_refresh at most
+	return !bloom || !synced || time( NULL ) - synced > 2 * db->ban_refresh || bloom_maybe( bloom, login );
+}
+
+// stored passwords are hex digests of password + salt
+static void db_password_hex( struct db_s* db, const char* password, char* hex )
+{
+	char salted_pass[MAX_PASS_LEN + MAX_SALT_LEN + 1];
+
+	// unknown hash function in config, passwords are stored as is
+	if( !db->hash )
+	{
+		strcpy( hex, password );
+		return;
+	}
+
+	strcpy( salted_pass, password );
+	strcat( salted_pass, db->salt );
+	hash_hex( db->hash, salted_pass, hex );
+}
+
+static int db_register_user( db_conn_t* conn, user_t* user )
+{
+	MYSQL_BIND params[5], results[2];
+	unsigned long lens[3], login_len;
+	char password[MAX_DIGEST_HEX + 1], login[MAX_PLAYER_NAME + 1];
+	int hour, row;
+
+	if( conn->db->type != db_default )
+		return ntle_register_disabled;
+
+	lens[0] = strlen( user->login );
+	lens[1] = strlen( user->mail );
+	db_bind_string( params, ( char *)user->login, lens[0], lens );
+	db_bind_string( params + 1, ( char *)user->mail, lens[1], lens + 1 );
+	db_bind_int( params + 2, &user->ip, 1 );
+	db_bind_int( params + 3, &user->hour, 0 );
+	db_bind_string( results, login, sizeof login, &login_len );
+	db_bind_int( results + 1, &hour, 0 );
+
+	// check if already exist
+	if( ( row = db_execute( conn, ds_register_check, params, results ) ) < 0 )
+		return ntle_register_later;
+
+	if( row )
+	{
+		db_terminate( login, sizeof login, login_len );
+
+		if( !strcmp( user->login, login ) )
+			return ntle_login_exist;
+		else if( user->hour == hour )
+			return ntle_register_later;
+		else
+			return ntle_email_exist;
+	}
+
+	db_password_hex( conn->db, user->password, password );
+	lens[2] = strlen( password );
+
+	db_bind_string( params, ( char *)user->login, lens[0], lens );
+	db_bind_string( params + 1, password, lens[2], lens + 2 );
+	db_bind_string( params + 2, ( char *)user->mail, lens[1], lens + 1 );
+	db_bind_int( params + 3, &user->ip, 1 );
+	db_bind_int( params + 4, &user->hour, 0 );
+
+	if( db_execute( conn, ds_insert, params, NULL ) < 0 )
+		return ntle_register_later;
+
+	db_logins_add( conn->db, user->login );
+	return ntle_no_error;
+}
+
+static int db_login_xenforo( db_conn_t* conn, user_t* user, unsigned long long* tag )
+{
+	MYSQL_BIND param, result;
+	unsigned long len, data_len;
+	unsigned user_id;
+	char data[SQL_QUERY_MAXLEN];
+	char xf_hash[MAX_DIGEST_HEX + 1], xf_salt[MAX_DIGEST_HEX + 1], xf_hash_func[8];
+	char salted_pass[MAX_DIGEST_HEX * 2 + 1];
+	hash_func_t hash_func;
+
+	len = strlen( user->login );
+	db_bind_string( &param, ( char *)user->login, len, &len );
+	db_bind_int( &result, &user_id, 1 );
+
+	if( db_execute( conn, ds_xf_user, &param, &result ) <= 0 )
+		return 0;
+
+	db_bind_int( &param, &user_id, 1 );
+	db_bind_string( &result, data, sizeof data, &data_len );
+
+	if( db_execute( conn, ds_xf_auth, &param, &result ) <= 0 )
+		return 0;
+
+	db_terminate( data, sizeof data, data_len );
+
+	if(
+		!php_get_serialized( data, "hash", xf_hash, sizeof xf_hash - 1 ) ||
+		!php_get_serialized( data, "salt", xf_salt, sizeof xf_salt - 1 ) ||
+		!php_get_serialized( data, "hashFunc", xf_hash_func, sizeof xf_hash_func - 1 ) ||
+		( hash_func = get_hash_func( xf_hash_func ) ) == NULL
+	  )
+		return 0;
+
+	// hash = hashfunc( hashfunc( pass ) + salt ), hex digests as in php
+	hash_hex( hash_func, user->password, salted_pass );
+	strcat( salted_pass, xf_salt );
+	hash_hex( hash_func, salted_pass, salted_pass );
+	*tag = creds_tag( data );
+
+	return !strcmp( salted_pass, xf_hash );
+}
+
+// tag gets stored password hash of accepted login
+static int db_login_user( db_conn_t* conn, user_t* user, unsigned long long* tag )
+{
+	MYSQL_BIND params[2];
+	unsigned long lens[2];
+	char password[MAX_DIGEST_HEX + 1];
+	int res;
+
+	if( conn->db->type == db_default )
+	{
+		db_password_hex( conn->db, user->password, password );
+		lens[0] = strlen( user->login );
+		lens[1] = strlen( password );
+		db_bind_string( params, ( char *)user->login, lens[0], lens );
+		db_bind_string( params + 1, password, lens[1], lens + 1 );
+
+		res		= db_execute( conn, ds_login, params, NULL ) > 0;
+		*tag	= creds_tag( password );
+	}
+	else
+		res = db_login_xenforo( conn, user, tag );
+
+	return res ? ntle_no_error : ntle_login_failed;
+}
+
+#ifndef __windows__
+// mysql compares logins and digests case insensitive and without trailing spaces
+static int db_same( const char* s, const char* t )
+{
+	for( ; *s && tolower( ( byte )*s ) == tolower( ( byte )*t ); ++s, ++t );
+	for( ; *s == ' '; ++s );
+	for( ; *t == ' '; ++t );
+
+	return *s == *t;
+}
+
+// appends escaped logins and closing bracket of IN list to query, returns its length
+static unsigned long db_in_logins( db_conn_t* conn, char* query, unsigned long len, const char** logins, int count )
+{
+	int i;
+
+	for( i = 0; i < count; ++i )
+	{
+		query[len++] = i ? ',' : ' ';
+		query[len++] = '\'';
+		len += mysql_real_escape_string( conn->mysql, query + len, logins[i], strlen( logins[i] ) );
+		query[len++] = '\'';
+	}
+
+	return len + sprintf( query + len, " )" );
+}
+
+// logins of default db by one query, rows are matched to jobs. returns 0 if query failed
+static int db_login_batch( db_conn_t* conn, db_job_t** jobs, int count )
+{
+	char query[DB_BATCH_MAX * ( MAX_PLAYER_NAME * 2 + 4 ) + SQL_QUERY_MAXLEN];
+	char passwords[DB_BATCH_MAX][MAX_DIGEST_HEX + 1];
+	const char* logins[DB_BATCH_MAX];
+	MYSQL_RES* res;
+	MYSQL_ROW row;
+	unsigned long len;
+	int i;
+
+	for( i = 0; i < count; ++i )
+	{
+		logins[i] = jobs[i]->login;
+		db_password_hex( conn->db, jobs[i]->password, passwords[i] );
+		jobs[i]->result = ntle_login_failed;
+	}
+
+	len = sprintf( query, "SELECT `login`, `password` FROM `" NTL_USERS_TABLE "` WHERE `login` IN (" );
+	len = db_in_logins( conn, query, len, logins, count );
+
+	if( mysql_real_query( conn->mysql, query, len ) || ( res = mysql_store_result( conn->mysql ) ) == NULL )
+	{
+		conn->error = mysql_errno( conn->mysql );
+		dbg( "db_login_batch: %s\n", mysql_error( conn->mysql ) );
+		return 0;
+	}
+
+	while( ( row = mysql_fetch_row( res ) ) != NULL )
+	{
+		if( !row[0] || !row[1] )
+			continue;
+
+		for( i = 0; i < count; ++i )
+		{
+			if( db_same( row[0], jobs[i]->login ) && db_same( row[1], passwords[i] ) )
+			{
+				jobs[i]->result	= ntle_no_error;
+				jobs[i]->tag	= creds_tag( row[1] );
+			}
+		}
+	}
+
+	mysql_free_result( res );
+	return 1;
+}
+
+// password changed on site or forum is seen by stored hash. cached logins are checked by batches,
+// those with other hash or removed user are forgotten. returns 0 if query failed
+static int db_creds_sweep( struct db_s* db, int full )
+{
+	char query[DB_BATCH_MAX * ( MAX_PLAYER_NAME * 2 + 4 ) + SQL_QUERY_MAXLEN];
+	char logins[DB_BATCH_MAX][MAX_PLAYER_NAME + 1];
+	const char* list[DB_BATCH_MAX];
+	unsigned long long tags[DB_BATCH_MAX];
+	int valid[DB_BATCH_MAX];
+	db_conn_t* conn;
+	MYSQL_RES* res;
+	MYSQL_ROW row;
+	unsigned long len;
+	int pos, count, i;
+
+	conn = &db->refresh_conn;
+
+	for( pos = 0; pos != CREDS_NONE; )
+	{
+		for( count = 0; count < DB_BATCH_MAX && ( pos = creds_next( db->creds, pos, logins[count], tags + count ) ) != CREDS_NONE; ++count )
+		{
+			list[count]		= logins[count];
+			valid[count]	= 0;
+		}
+
+		if( !count )
+			break;
+
+		if( db->type == db_default )
+			len = sprintf( query, "SELECT `login`, `password` FROM `" NTL_USERS_TABLE "` WHERE `login` IN (" );
+		else
+			len = sprintf( query, "SELECT u.`username`, a.`data` FROM `" XF_USERS_TABLE "` u JOIN `" XF_PASSWORDS_TABLE "` a ON a.`user_id`=u.`user_id` WHERE u.`username` IN (" );
+
+		len = db_in_logins( conn, query, len, list, count );
+
+		if( mysql_real_query( conn->mysql, query, len ) || ( res = mysql_store_result( conn->mysql ) ) == NULL )
+		{
+			conn->error = mysql_errno( conn->mysql );
+			dbg( "db_creds_sweep: %s\n", mysql_error( conn->mysql ) );
+			return 0;
+		}
+
+		while( ( row = mysql_fetch_row( res ) ) != NULL )
+		{
+			if( !row[0] || !row[1] )
+				continue;
+
+			for( i = 0; i < count; ++i )
+			{
+				if( db_same( row[0], logins[i] ) && creds_tag( row[1] ) == tags[i] )
+					valid[i] = 1;
+			}
+		}
+
+		mysql_free_result( res );
+
+		for( i = 0; i < count; ++i )
+		{
+			if( !valid[i] )
+				creds_forget( db->creds, logins[i] );
+		}
+	}
+
+	return 1;
+}
+#endif
+
+static void db_run( db_conn_t* conn, db_job_t* job )
+{
+	user_t user;
+
+	user.login		= job->login;
+	user.password	= job->password;
+	user.mail		= job->mail;
+	user.hour		= job->hour;
+	user.ip			= job->ip;
+	user.server		= job->server;
+
+	if( job->type == dj_login )
+		job->result = db_login_user( conn, &user, &job->tag );
+	else
+		job->result = db_register_user( conn, &user );
+}
+
+void db_job_run( struct db_s* db, db_job_t* job )
+{
+	db_conn_t* conn = db->conns + job->thread_id % db->conns_count;
+	db_conn_run( conn, job );
+}
@@ -1,6 +1,8 @@
 #ifndef DATABASE_H
 #define DATABASE_H
 
+#include "const.h"
+
 typedef struct user_s
 {
 	const char*			login;
@@ -11,13 +13,49 @@ typedef struct user_s
 	int					server;
 } user_t;
 
+enum db_job_e
+{
+	dj_login,
+	dj_register
+};
+
+// request for database thread. message strings are copied, so connection buffer can be reused.
+// lives in connection, nothing is allocated per request
+typedef struct db_job_s
+{
+	struct db_job_s*	next;
+	struct db_job_s*	followers;	// same login queued while this one is in flight, get its result
+	struct db_job_s*	flight_next;	// in flight jobs with same key hash
+	unsigned			key;
+	void*				ctx;		// waiting connection, NULL if it was closed
+	int					thread_id;	// work thread which gets completion
+	int					type;
+	int					result;
+	unsigned long long	tag;		// of stored password hash after login, for credentials cache
+	int					server;
+	int					hour;
+	ip_t				ip;
+	char				hwid[MAX_HWID_LEN + 1];
+	char				login[MAX_PLAYER_NAME + 1];
+	char				password[MAX_PASS_LEN + 1];
+	char				mail[MAX_EMAIL_LEN + 1];
+} db_job_t;
+
 struct db_s;
 struct xml_s;
+struct epoch_s;
+struct creds_s;
 
-struct db_s* db_init( struct xml_s* cfg );
+struct db_s* db_init( struct xml_s* cfg, int threads_count );
 void db_close( struct db_s* db );
-int db_is_hwid_banned( struct db_s* db, const char* hwid );
-int db_register_user( struct db_s* db, user_t* user );
-int db_login_user( struct db_s* db, user_t* user );
+int db_preload( struct db_s* db, struct epoch_s* epoch, struct creds_s* creds ); // loads bans and logins and starts their refresh, work threads are readers of epoch. refresh drops cached logins with changed password
+int db_is_banned( struct db_s* db, const char* hwid ); // for work thread, memory lookup without query
+int db_login_exists( struct db_s* db, const char* login ); // for work thread, 0 if login surely isn't in users table
+void db_job_run( struct db_s* db, db_job_t* job ); // runs job in calling thread on connection of job->thread_id
+#ifndef __windows__
+void db_submit( struct db_s* db, db_job_t* job ); // job goes to database thread, caller keeps it until db_completed returns it
+db_job_t* db_completed( struct db_s* db, int thread_id ); // takes finished jobs of work thread in submit order
+int db_event_fd( struct db_s* db, int thread_id ); // readable when work thread has finished jobs
+#endif
 
 #endif // DATABASE_H
\ No newline at end of file
@@ -0,0 +1,102 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "epoch.h"
+
+int epoch_init( epoch_t* ep, int readers_count )
+{
+	int i;
+
+	if( ( ep->readers = ( epoch_reader_t * )calloc( readers_count, sizeof( epoch_reader_t ) ) ) == NULL )
+	{
+		perror( "epoch_init" );
+		return 0;
+	}
+
+	ep->readers_count = readers_count;
+	atomic_init( &ep->global, 0 );
+
+	for( i = 0; i < readers_count; ++i )
+		atomic_init( &ep->readers[i].epoch, 0 );
+
+	return 1;
+}
+
+void epoch_free( epoch_t* ep )
+{
+	free( ( void * )ep->readers );
+	ep->readers = NULL;
+}
+
+void epoch_quiescent( epoch_t* ep, int reader )
+{
+	epoch_reader_t *r, *end;
+	unsigned global;
+
+	global = atomic_load( &ep->global );
+
+	if( atomic_load_explicit( &ep->readers[reader].epoch, memory_order_relaxed ) != global )
+		atomic_store( &ep->readers[reader].epoch, global );
+
+	// last thread seen in this epoch moves it forward
+	for( r = ep->readers, end = r + ep->readers_count; r < end; ++r )
+	{
+		if( atomic_load( &r->epoch ) != global )
+			return;
+	}
+
+	atomic_compare_exchange_strong( &ep->global, &global, global + 1 );
+}
+
+void epoch_retire( epoch_t* ep, epoch_limbo_t* limbo, epoch_node_t* node, epoch_func_t func )
+{
+	node->epoch	= atomic_load( &ep->global );
+	node->func	= func;
+	node->next	= limbo->head;
+	limbo->head	= node;
+	++limbo->count;
+}
+
+static void epoch_run( epoch_node_t* node, void* arg )
+{
+	epoch_node_t* next;
+
+	for( ; node; node = next )
+	{
+		next = node->next;
+		node->func( node, arg );
+	}
+}
+
+void epoch_reclaim( epoch_t* ep, epoch_limbo_t* limbo, void* arg )
+{
+	epoch_node_t **pnode, *node;
+	unsigned global;
+	int count;
+
+	global = atomic_load( &ep->global );
+
+	// list is sorted by epoch, newest first, so everything after first old node is old too
+	for( pnode = &limbo->head, count = 0; ( node = *pnode ) != NULL; pnode = &node->next, ++count )
+	{
+		if( global - node->epoch >= 2 )
+			break;
+	}
+
+	if( node == NULL )
+		return;
+
+	*pnode			= NULL;
+	limbo->count	= count;
+	epoch_run( node, arg );
+}
+
+void epoch_flush( epoch_limbo_t* limbo, void* arg )
+{
+	epoch_node_t* node;
+
+	node			= limbo->head;
+	limbo->head		= NULL;
+	limbo->count	= 0;
+	epoch_run( node, arg );
+}
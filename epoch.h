@@ -0,0 +1,47 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <stdatomic.h>
+#include "const.h"
+
+struct epoch_node_s;
+typedef void ( *epoch_func_t )( struct epoch_node_s* node, void* arg );
+
+typedef struct epoch_node_s
+{
+	struct epoch_node_s*	next;
+	unsigned				epoch;		// global epoch when retired
+	epoch_func_t			func;
+} epoch_node_t;
+
+// quiescent state of one work thread, on own cache line
+typedef struct epoch_reader_s
+{
+	atomic_uint				epoch;
+	char					__dontusebuf[CPU_CACHE_LINE - sizeof( int )];
+} epoch_reader_t;
+
+// retired nodes of one owner, newest first
+typedef struct epoch_limbo_s
+{
+	epoch_node_t*			head;
+	int						count;
+} epoch_limbo_t;
+
+// quiescent state based reclamation. work thread holds no shared node between loop passes,
+// so node unlinked in epoch e is freed when global epoch is e + 2: every thread passed loop top since
+typedef struct epoch_s
+{
+	atomic_uint				global;
+	epoch_reader_t*			readers;
+	int						readers_count;
+} epoch_t;
+
+int epoch_init( epoch_t* ep, int readers_count );
+void epoch_free( epoch_t* ep );
+void epoch_quiescent( epoch_t* ep, int reader ); // call at loop top, when thread holds no shared nodes
+void epoch_retire( epoch_t* ep, epoch_limbo_t* limbo, epoch_node_t* node, epoch_func_t func ); // node must be unlinked
+void epoch_reclaim( epoch_t* ep, epoch_limbo_t* limbo, void* arg ); // runs func of nodes after grace period
+void epoch_flush( epoch_limbo_t* limbo, void* arg ); // runs func of all nodes, all readers must be paused
+
+#endif // EPOCH_H
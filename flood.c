@@ -0,0 +1,161 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "flood.h"
+#include "config.h"
+#include "timer.h"
+#include "ntl.h"
+#include "net.h"
+
+// odd multipliers, each row spreads ips differently
+static const unsigned flood_seeds[FLOOD_ROWS] = { 0x9E3779B1u, 0x85EBCA77u, 0xC2B2AE3Du, 0x27D4EB2Fu };
+
+int flood_init( flood_t* flood, struct xml_s* cfg )
+{
+	int bits, width, threshold, window;
+	unsigned n;
+
+	memset( flood, 0, sizeof( flood_t ) );
+
+	if( ( width = xml_get_int( cfg, "flood_sketch_width" ) ) <= 0 )
+		width = FLOOD_SKETCH_WIDTH;
+
+	if( ( threshold = xml_get_int( cfg, "flood_threshold" ) ) <= 0 )
+		threshold = FLOOD_THRESHOLD;
+
+	if( ( window = xml_get_int( cfg, "flood_window" ) ) <= 0 )
+		window = FLOOD_WINDOW;
+
+	for( n = 1, bits = 0; n < ( unsigned )width; n <<= 1, ++bits );
+
+	if( ( flood->counters = ( atomic_uint * )calloc( n * FLOOD_ROWS, sizeof( atomic_uint ) ) ) == NULL )
+	{
+		fprintf( stderr, "flood_init: out of memory\n" );
+		return 0;
+	}
+
+	flood->mask			= n - 1;
+	flood->shift		= 32 - bits;
+	flood->threshold	= threshold;
+	flood->window		= window * ( 1000 / TIMER_TICK );
+	atomic_init( &flood->decayed, timer_ticks() );
+	atomic_flag_clear( &flood->lock );
+
+	return 1;
+}
+
+void flood_free( flood_t* flood )
+{
+	free( ( void *)flood->counters );
+	flood->counters = NULL;
+}
+
+// halves all counters for every passed window, so old connections fade out. one thread does it, others go on counting
+static void flood_decay( flood_t* flood, unsigned now )
+{
+	atomic_uint *counter, *end;
+	unsigned decayed, value, shift;
+	flood_top_t* top;
+
+	decayed = atomic_load_explicit( &flood->decayed, memory_order_relaxed );
+
+	if( ( shift = ( now - decayed ) / flood->window ) == 0 || !atomic_compare_exchange_strong( &flood->decayed, &decayed, now ) )
+		return;
+
+	if( shift > 31 )
+		shift = 31;
+
+	for( counter = flood->counters, end = counter + ( flood->mask + 1 ) * FLOOD_ROWS; counter < end; ++counter )
+	{
+		if( ( value = atomic_load_explicit( counter, memory_order_relaxed ) ) != 0 )
+			atomic_fetch_sub_explicit( counter, value - ( value >> shift ), memory_order_relaxed );
+	}
+
+	while( atomic_flag_test_and_set( &flood->lock ) );
+
+	for( top = flood->top; top < flood->top + FLOOD_TOP; ++top )
+		top->count >>= shift;
+
+	atomic_flag_clear( &flood->lock );
+}
+
+// keeps FLOOD_TOP biggest estimates, the smallest one is replaced
+static void flood_top( flood_t* flood, ip_t ip, unsigned count )
+{
+	flood_top_t *top, *min;
+
+	while( atomic_flag_test_and_set( &flood->lock ) );
+
+	for( top = min = flood->top; top < flood->top + FLOOD_TOP; ++top )
+	{
+		if( top->ip == ip )
+		{
+			min = top;
+			break;
+		}
+
+		if( top->count < min->count )
+			min = top;
+	}
+
+	if( min->ip == ip || count > min->count )
+	{
+		min->ip		= ip;
+		min->count	= count;
+	}
+
+	atomic_flag_clear( &flood->lock );
+}
+
+int flood_check( flood_t* flood, ip_t ip )
+{
+	unsigned hash, count, estimate;
+	int row;
+
+	flood_decay( flood, timer_ticks() );
+
+	for( row = 0, estimate = ~0u; row < FLOOD_ROWS; ++row )
+	{
+		hash	= flood->shift < 32 ? ( ip * flood_seeds[row] ) >> flood->shift : 0;
+		count	= atomic_fetch_add_explicit( flood->counters + row * ( flood->mask + 1 ) + hash, 1, memory_order_relaxed ) + 1;
+
+		if( count < estimate )
+			estimate = count;
+	}
+
+	if( estimate <= flood->threshold )
+		return 1;
+
+	flood_top( flood, ip, estimate );
+	return 0;
+}
+
+static int flood_top_cmp( const void* a, const void* b )
+{
+	unsigned x = ( ( const flood_top_t * )a )->count, y = ( ( const flood_top_t * )b )->count;
+
+	return ( y > x ) - ( y < x );
+}
+
+void flood_print( flood_t* flood )
+{
+	flood_top_t top[FLOOD_TOP];
+	int i, j;
+
+	while( atomic_flag_test_and_set( &flood->lock ) );
+	memcpy( top, flood->top, sizeof top );
+	atomic_flag_clear( &flood->lock );
+	qsort( top, FLOOD_TOP, sizeof( flood_top_t ), flood_top_cmp );
+
+	printf( "flood sources over %u connections in %u sec:\n", flood->threshold, flood->window / ( 1000 / TIMER_TICK ) );
+
+	for( i = 0, j = 0; i < FLOOD_TOP; ++i )
+	{
+		if( top[i].ip != INVALID_IP && top[i].count > flood->threshold )
+			printf( "%2i. %i.%i.%i.%i %u\n", ++j, IP_TO_ARGS( top[i].ip ), top[i].count );
+	}
+
+	if( !j )
+		puts( "none" );
+}
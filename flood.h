@@ -0,0 +1,39 @@
+#ifndef FLOOD_H
+#define FLOOD_H
+
+#include <stdatomic.h>
+#include "const.h"
+
+#define FLOOD_ROWS			4
+#define FLOOD_TOP			16
+
+typedef struct flood_top_s
+{
+	ip_t					ip;
+	unsigned				count;
+} flood_top_t;
+
+// count-min sketch of connections per ip, halved every window. memory doesn't depend on count of sources,
+// so ip over threshold is closed before any state is made for it
+typedef struct flood_s
+{
+	atomic_uint*			counters;	// FLOOD_ROWS rows
+	unsigned				mask;
+	int						shift;
+	unsigned				threshold;
+	unsigned				window;		// ticks
+	atomic_uint				decayed;	// tick of last halving
+
+	// heaviest ips seen over threshold, for console
+	atomic_flag				lock;
+	flood_top_t				top[FLOOD_TOP];
+} flood_t;
+
+struct xml_s;
+
+int flood_init( flood_t* flood, struct xml_s* cfg );
+void flood_free( flood_t* flood );
+int flood_check( flood_t* flood, ip_t ip ); // counts connection, returns 0 if ip floods
+void flood_print( flood_t* flood );
+
+#endif // FLOOD_H
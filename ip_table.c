@@ -0,0 +1,103 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "ip_table.h"
+
+#ifndef IP_TABLE_SIMD
+
+int ip_table_init( ip_table_t* table, unsigned size )
+{
+	unsigned n;
+	int bits;
+
+	for( n = 1, bits = 0; n < size; n <<= 1, ++bits );
+
+	if( ( table->slots = ( ip_slot_t * )calloc( n, sizeof( ip_slot_t ) ) ) == NULL )
+	{
+		fprintf( stderr, "ip_table_init: out of memory\n" );
+		return 0;
+	}
+
+	table->mask		= n - 1;
+	table->shift	= 32 - bits;
+	atomic_init( &table->count, 0 );
+
+	return 1;
+}
+
+void ip_table_free( ip_table_t* table )
+{
+	free( ( void *)table->slots );
+	table->slots = NULL;
+}
+
+// fibonacci hashing, high bits of product are well mixed even for ips from one subnet
+static unsigned ip_table_hash( const ip_table_t* table, ip_t ip )
+{
+	return table->shift < 32 ? ( ip * 0x9E3779B1u ) >> table->shift : 0;
+}
+
+void* ip_table_find( const ip_table_t* table, ip_t ip )
+{
+	const ip_slot_t* slot;
+	unsigned i, n, key;
+
+	for( i = ip_table_hash( table, ip ), n = 0; n < IP_TABLE_PROBES && n <= table->mask; i = ( i + 1 ) & table->mask, ++n )
+	{
+		slot = table->slots + i;
+
+		if( ( key = atomic_load( &slot->ip ) ) == IP_SLOT_EMPTY )
+			break;
+
+		if( key == ip )
+			return ( void *)atomic_load( &slot->value );
+	}
+
+	return NULL;
+}
+
+int ip_table_add( ip_table_t* table, ip_t ip, void* value )
+{
+	ip_slot_t* slot;
+	unsigned i, n, key;
+
+	for( i = ip_table_hash( table, ip ), n = 0; n < IP_TABLE_PROBES && n <= table->mask; i = ( i + 1 ) & table->mask, ++n )
+	{
+		slot	= table->slots + i;
+		key		= atomic_load( &slot->ip );
+
+		// claim free slot, other thread can win it first, then probe next
+		if( ( key == IP_SLOT_EMPTY || key == IP_SLOT_TOMB ) && atomic_compare_exchange_strong( &slot->ip, &key, ip ) )
+		{
+			atomic_store( &slot->value, ( intptr_t )value );
+			atomic_fetch_add( &table->count, 1 );
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+void ip_table_remove( ip_table_t* table, int slot )
+{
+	unsigned i, n, key;
+
+	atomic_store( &table->slots[slot].value, 0 );
+	atomic_store( &table->slots[slot].ip, IP_SLOT_TOMB );
+	atomic_fetch_sub( &table->count, 1 );
+
+	// tombstones right before empty slot end no probe chain, make them empty again.
+	// key added after the check can become unreachable, antiflood then only misses one ip
+	if( atomic_load( &table->slots[( slot + 1 ) & table->mask].ip ) != IP_SLOT_EMPTY )
+		return;
+
+	for( i = slot, n = 0; n <= table->mask; i = ( i - 1 ) & table->mask, ++n )
+	{
+		key = IP_SLOT_TOMB;
+
+		if( !atomic_compare_exchange_strong( &table->slots[i].ip, &key, IP_SLOT_EMPTY ) )
+			break;
+	}
+}
+
+#endif // IP_TABLE_SIMD
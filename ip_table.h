@@ -0,0 +1,54 @@
+#ifndef IP_TABLE_H
+#define IP_TABLE_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include "const.h"
+
+#define IP_SLOT_EMPTY		INVALID_IP
+#define IP_SLOT_TOMB		0xFFFFFFFF	// broadcast address never connects
+#define IP_TABLE_PROBES		128
+#define IP_TABLE_VECTOR		8			// ips in widest compare, simd table size is multiple of it
+
+#ifdef IP_TABLE_SIMD
+// ips and values in parallel arrays, find compares vector of ips at once. for small tables, where linear
+// scan of a few cache lines is cheaper than hash probing. only first used slots are scanned
+typedef struct ip_table_s
+{
+	atomic_uint*		ips;
+	atomic_intptr_t*	values;		// 0 while slot is claimed but not filled
+	unsigned			size;
+	atomic_uint			used;		// slots after last claimed one are empty
+	atomic_int			count;
+} ip_table_t;
+
+#define ip_table_size( table )			( ( table )->size )
+#define ip_table_value( table, slot )	( ( table )->values + ( slot ) )
+#else
+typedef struct ip_slot_s
+{
+	atomic_uint			ip;
+	atomic_intptr_t		value;		// 0 while slot is claimed but not filled
+} ip_slot_t;
+
+// open addressing with linear probing, shared by all work threads without locks.
+// entry is removed by its slot index, so only its owner removes it
+typedef struct ip_table_s
+{
+	ip_slot_t*			slots;
+	unsigned			mask;
+	int					shift;
+	atomic_int			count;
+} ip_table_t;
+
+#define ip_table_size( table )			( ( table )->mask + 1 )
+#define ip_table_value( table, slot )	( &( table )->slots[slot].value )
+#endif
+
+int ip_table_init( ip_table_t* table, unsigned size ); // size is rounded up to power of 2, or to IP_TABLE_VECTOR for simd table
+void ip_table_free( ip_table_t* table );
+void* ip_table_find( const ip_table_t* table, ip_t ip );
+int ip_table_add( ip_table_t* table, ip_t ip, void* value ); // returns slot or -1 if no free slot in probe range
+void ip_table_remove( ip_table_t* table, int slot );
+
+#endif // IP_TABLE_H
@@ -0,0 +1,162 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "ip_table.h"
+
+#ifdef IP_TABLE_SIMD
+
+#if defined( __AVX2__ )
+	#include <immintrin.h>
+#elif defined( __SSE2__ ) || defined( _M_IX86_FP ) || defined( _M_X64 )
+	#include <emmintrin.h>
+#endif
+#ifdef _MSC_VER
+	#include <intrin.h>
+#endif
+
+int ip_table_init( ip_table_t* table, unsigned size )
+{
+	size = ( size + IP_TABLE_VECTOR - 1 ) & ~( IP_TABLE_VECTOR - 1 );
+
+	table->ips		= ( atomic_uint * )calloc( size, sizeof( atomic_uint ) );
+	table->values	= ( atomic_intptr_t * )calloc( size, sizeof( atomic_intptr_t ) );
+
+	if( !table->ips || !table->values )
+	{
+		fprintf( stderr, "ip_table_init: out of memory\n" );
+		return 0;
+	}
+
+	table->size = size;
+	atomic_init( &table->used, 0 );
+	atomic_init( &table->count, 0 );
+
+	return 1;
+}
+
+void ip_table_free( ip_table_t* table )
+{
+	free( ( void *)table->ips );
+	free( ( void *)table->values );
+	table->ips		= NULL;
+	table->values	= NULL;
+}
+
+static int ip_table_ctz( unsigned mask )
+{
+#ifdef _MSC_VER
+	unsigned long i;
+
+	_BitScanForward( &i, mask );
+	return ( int )i;
+#else
+	return __builtin_ctz( mask );
+#endif
+}
+
+// returns first slot from start up to end with ip, or -1. start and end are multiples of IP_TABLE_VECTOR.
+// aligned vector loads of ints don't tear, and match is checked again by caller with atomic load
+static int ip_table_scan( const ip_table_t* table, unsigned start, unsigned end, ip_t ip )
+{
+	const atomic_uint* ips;
+	unsigned i;
+
+	ips = table->ips;
+
+#if defined( __AVX2__ )
+	__m256i key = _mm256_set1_epi32( ( int )ip );
+	unsigned mask;
+
+	for( i = start; i < end; i += 8 )
+	{
+		if( ( mask = _mm256_movemask_ps( _mm256_castsi256_ps( _mm256_cmpeq_epi32( key, _mm256_loadu_si256( ( const __m256i * )( ips + i ) ) ) ) ) ) != 0 )
+			return i + ip_table_ctz( mask );
+	}
+#elif defined( __SSE2__ ) || defined( _M_IX86_FP ) || defined( _M_X64 )
+	__m128i key = _mm_set1_epi32( ( int )ip );
+	unsigned mask;
+
+	for( i = start; i < end; i += 4 )
+	{
+		if( ( mask = _mm_movemask_ps( _mm_castsi128_ps( _mm_cmpeq_epi32( key, _mm_loadu_si128( ( const __m128i * )( ips + i ) ) ) ) ) ) != 0 )
+			return i + ip_table_ctz( mask );
+	}
+#else
+	for( i = start; i < end; ++i )
+	{
+		if( atomic_load_explicit( ( atomic_uint * )ips + i, memory_order_relaxed ) == ip )
+			return i;
+	}
+#endif
+
+	return -1;
+}
+
+static unsigned ip_table_end( unsigned used )
+{
+	return ( used + IP_TABLE_VECTOR - 1 ) & ~( IP_TABLE_VECTOR - 1 );
+}
+
+void* ip_table_find( const ip_table_t* table, ip_t ip )
+{
+	unsigned start, end;
+	intptr_t value;
+	int i;
+
+	end = ip_table_end( atomic_load( &( ( ip_table_t * )table )->used ) );
+
+	// inner loop leaves i on next vector, scan goes on from there
+	for( start = 0; ( i = ip_table_scan( table, start, end, ip ) ) >= 0; start = i )
+	{
+		// slot could be freed and taken by other ip between compare and value load
+		if( ( value = atomic_load( table->values + i ) ) != 0 && atomic_load( table->ips + i ) == ip )
+			return ( void *)value;
+
+		// rest of vector after this slot
+		while( ( unsigned )++i & ( IP_TABLE_VECTOR - 1 ) )
+		{
+			if( atomic_load( table->ips + i ) == ip && ( value = atomic_load( table->values + i ) ) != 0 )
+				return ( void *)value;
+		}
+	}
+
+	return NULL;
+}
+
+int ip_table_add( ip_table_t* table, ip_t ip, void* value )
+{
+	unsigned start, used, key;
+	int i;
+
+	// lowest empty slot, so used part stays short while count is stable
+	for( start = 0; ( i = ip_table_scan( table, start, table->size, IP_SLOT_EMPTY ) ) >= 0; )
+	{
+		key = IP_SLOT_EMPTY;
+
+		// other thread can win slot first, then scan again from its vector
+		if( !atomic_compare_exchange_strong( table->ips + i, &key, ip ) )
+		{
+			start = i & ~( IP_TABLE_VECTOR - 1 );
+			continue;
+		}
+
+		atomic_store( table->values + i, ( intptr_t )value );
+		atomic_fetch_add( &table->count, 1 );
+
+		for( used = atomic_load( &table->used ); used < ( unsigned )i + 1 && !atomic_compare_exchange_weak( &table->used, &used, i + 1 ); );
+
+		return i;
+	}
+
+	return -1;
+}
+
+void ip_table_remove( ip_table_t* table, int slot )
+{
+	// no probe chains here, slot is empty at once
+	atomic_store( table->values + slot, 0 );
+	atomic_store( table->ips + slot, IP_SLOT_EMPTY );
+	atomic_fetch_sub( &table->count, 1 );
+}
+
+#endif // IP_TABLE_SIMD
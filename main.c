@@ -12,11 +12,20 @@
 #endif
 
 #include "client.h"
+#include "conn.h"
+#include "timer.h"
+#include "epoch.h"
+#include "flood.h"
+#include "net_uring.h"
 #include "net.h"
 #include "const.h"
 #include "config.h"
 #include "database.h"
+#include "mem.h"
 #include "servers.h"
+#include "session.h"
+#include "creds.h"
+#include "state.h"
 #include "util.h"
 #include "sys.h"
 #include "ntl.h"
@@ -26,7 +35,9 @@ static int CALLBACK main_worker_thread( thread_t* thread )
 {
 	socket_t conn_sock;
 	char buf[128];
+	int answer;
 	time_t curtime, last_connection;
+	db_job_t job;
 	ntl_t* ntl;
 	msg_t msg;
 	net_t net;
@@ -47,8 +58,12 @@ static int CALLBACK main_worker_thread( thread_t* thread )
 			break;
 
 		case ts_pause:
+			// stay here while signal is set, paused thread doesn't touch shared structures
 			atomic_store( &thread->paused, true );
-			sys_wait_unlock( ntl->threads_lock, THREAD_TIMEOUT );
+
+			while( atomic_load( &ntl->threads_signal ) == ts_pause )
+				sys_sleep( THREAD_CHECK_FREE );
+
 			atomic_store( &thread->paused, false );
 			break;
 
@@ -56,6 +71,9 @@ static int CALLBACK main_worker_thread( thread_t* thread )
 			return EXIT_SUCCESS;
 		}
 
+		// thread holds no client or ban set here
+		epoch_quiescent( net.clients.epoch, thread - ntl->threads );
+
 		if( conn_sock )
 		{
 			conn_sock = THREAD_NO_CLIENT;
@@ -82,7 +100,16 @@ static int CALLBACK main_worker_thread( thread_t* thread )
 			msg.readcount = 0;
 			msg.maxsize = net_recv( conn_sock, buf, sizeof buf );
 			
-			if( !client_read_message( conn_sock, &msg, ntl ) )
+			job.thread_id = thread - ntl->threads;
+
+			// no database threads on windows, this thread waits for query
+			if( ( answer = client_read_message( net_get_ip( conn_sock ), &msg, ntl, &job ) ) == PENDING_ANSWER )
+			{
+				db_job_run( ntl->db, &job );
+				answer = client_job_done( &job, ntl );
+			}
+
+			if( answer == NO_ANSWER || net_send_answer( conn_sock, answer ) <= 0 )
 				net_closesocket( conn_sock );
 			
 			// set ready for next message
@@ -117,21 +144,84 @@ int CALLBACK pipe_reader_thread( struct server_s* server )
 	return EXIT_SUCCESS;
 }
 #else
+// reads, answers and writes until socket would block. returns 0 if connection must be closed
+static int worker_conn_event( int epollfd, conn_t* conn, ntl_t* ntl )
+{
+	struct epoll_event ev;
+	int state, result, flush;
+
+	for(;;)
+	{
+		// message can come in several segments, collect it in connection buffer.
+		// pipelined messages of keepalive connection can fill it few times
+		state	= conn->done ? cr_drained : conn_recv( conn );
+		result	= conn_process( conn, ntl );
+		flush	= conn_flush( conn );
+
+		if( result == cp_error || flush == cw_error )
+			return 0;
+
+		// client doesn't read answers, continue on EPOLLOUT
+		if( flush == cw_again )
+			break;
+
+		if( result == cp_done || state == cr_closed )
+			return 0;
+
+		// connection is resumed by database completion
+		if( state == cr_drained || result == cp_pending )
+			break;
+	}
+
+	// keepalive connection is closed if idle, one message connection keeps first deadline
+	if( conn->keepalive )
+		conn_deadline( conn, ntl->net->keepalive_timeout * 1000 );
+
+	// EPOLLOUT only while answers wait in queue
+	ev.events	= EPOLLIN | EPOLLET | ( flush == cw_again ? EPOLLOUT : 0 );
+	ev.data.ptr	= conn;
+
+	if( ev.events != conn->events )
+	{
+		if( epoll_ctl( epollfd, EPOLL_CTL_MOD, conn->sock, &ev ) == EPOLL_ERROR )
+		{
+			perror( "epoll_ctl::conn_sock" );
+			return 0;
+		}
+
+		conn->events = ev.events;
+	}
+
+	return 1;
+}
+
 static int CALLBACK main_worker_thread( thread_t* thread )
 {
 	struct epoll_event ev, events[MAX_EVENTS], *pev, *end;
 	socket_t conn_sock;
-	int evcount, epollfd, n, count, thread_id;
-	char buf[128];
+	db_job_t *job, *next;
+	int evcount, epollfd, n, thread_id, db_ready;
+	socket_t listen_sock;
+	ip_t ip;
+	conn_pool_t pool;
+	conn_t* conn;
 	ntl_t* ntl;
-	msg_t msg;
 	net_t net;
 
 	// copy for perfomance
 	ntl = thread->ntl;
 	memcpy( &net, ntl->net, sizeof net );
-	msg.data = buf;
+	memset( &pool, 0, sizeof pool );
 	thread_id = thread - ntl->threads;
+	listen_sock = NET_LISTEN_SOCK( &net, thread_id );
+	pool.wheel = net.clients.wheels + thread_id;
+	pool.thread_id = thread_id;
+
+#ifdef HAVE_IO_URING
+	// io_uring loop selected in config, epoll is fallback if ring can't be created
+	if( net.uring && ( n = net_uring_worker( thread ) ) != URING_UNAVAILABLE )
+		return n;
+#endif
 
 	// create epoll
 	if( ( epollfd = epoll_create1( 0 ) ) == EPOLL_ERROR )
@@ -140,16 +230,26 @@ static int CALLBACK main_worker_thread( thread_t* thread )
 		return EXIT_FAILURE;
 	}
 
-	// add main socket to epoll for incoming
+	// add main socket (or own reuseport listener) to epoll for incoming. clients have their conn in data.ptr
 	ev.events	= EPOLLIN;
-	ev.data.fd	= net.listen_sock;
+	ev.data.ptr	= NULL;
 
-	if( epoll_ctl( epollfd, EPOLL_CTL_ADD, net.listen_sock, &ev ) == EPOLL_ERROR )
+	if( epoll_ctl( epollfd, EPOLL_CTL_ADD, listen_sock, &ev ) == EPOLL_ERROR )
 	{
 		perror( "epoll_ctl::listen_sock" );
 		return EXIT_FAILURE;
 	}
 
+	// database completions of this thread come with db in data.ptr
+	ev.events	= EPOLLIN;
+	ev.data.ptr	= ntl->db;
+
+	if( epoll_ctl( epollfd, EPOLL_CTL_ADD, db_event_fd( ntl->db, thread_id ), &ev ) == EPOLL_ERROR )
+	{
+		perror( "epoll_ctl::db_event_fd" );
+		return EXIT_FAILURE;
+	}
+
 	// handle connections
 	for(;;)
 	{
@@ -160,17 +260,27 @@ static int CALLBACK main_worker_thread( thread_t* thread )
 			break;
 
 		case ts_pause:
+			// stay here while signal is set, paused thread doesn't touch shared structures
 			atomic_store( &thread->paused, true );
-			sys_wait_unlock( ntl->threads_lock, THREAD_TIMEOUT );
+
+			while( atomic_load( &ntl->threads_signal ) == ts_pause )
+				sys_sleep( THREAD_CHECK_FREE );
+
 			atomic_store( &thread->paused, false );
 			break;
 
 		case ts_exit:
+			conn_pool_free( &pool );
 			return EXIT_SUCCESS;
 		}
 
+		// thread holds no client here. expire connections and clients before wait, so no closed connection is in events
+		epoch_quiescent( net.clients.epoch, thread_id );
+		timer_advance( pool.wheel, timer_ticks(), ntl );
+		epoch_reclaim( net.clients.epoch, net.clients.limbos + thread_id, ntl );
+
 		// wait for events
-		if( ( evcount = epoll_wait( epollfd, events, sizeof events, THREAD_TIMEOUT ) ) == EPOLL_ERROR )
+		if( ( evcount = epoll_wait( epollfd, events, MAX_EVENTS, THREAD_TIMEOUT ) ) == EPOLL_ERROR )
 		{
 			perror( "epoll_wait" );
 			return EXIT_FAILURE;
@@ -185,61 +295,58 @@ static int CALLBACK main_worker_thread( thread_t* thread )
 
 		// else have events
 		atomic_store( &thread->timeout, false );
+		db_ready = 0;
 
 		for( pev = events, end = pev + evcount; pev < end; ++pev )
 		{
+			// completion can close connection, which has event later in this batch
+			if( pev->data.ptr == ntl->db )
+				db_ready = 1;
 			// new connection to main sock
-			if( pev->data.fd == net.listen_sock )
+			else if( ( conn = ( conn_t * )pev->data.ptr ) == NULL )
 			{
-				// accept client with antiflood check
-				if( ( conn_sock = net_accept( &net, thread_id ) ) == 0 )
-					continue;
-
-				// set nonblocking and add to epoll for reading
-				if( net_setnonblocking( conn_sock ) )
+				// drain accept queue with antiflood check, up to budget per wakeup.
+				// listener is level triggered, so the rest comes with next epoll_wait
+				for( n = 0; n < net.accept_budget && ( conn_sock = net_accept( &net, thread_id, &ip ) ) != NET_NO_CONNECTION; ++n )
 				{
-					ev.events	= EPOLLIN | EPOLLET;
-					ev.data.fd	= conn_sock;
+					if( conn_sock == 0 ) // rejected
+						continue;
+
+					if( ( conn = conn_alloc( &pool, conn_sock, ip ) ) == NULL )
+					{
+						net_closesocket( conn_sock );
+						continue;
+					}
+
+					ev.events		= EPOLLIN | EPOLLET;
+					ev.data.ptr		= conn;
+					conn->events	= ev.events;
 
 					if( epoll_ctl( epollfd, EPOLL_CTL_ADD, conn_sock, &ev ) == -1 )
 					{
 						perror( "epoll_ctl::conn_sock" );
 						return EXIT_FAILURE;
 					}
+
+					// silent connection must not hold fd
+					conn_deadline( conn, MESSAGE_TIMEOUT * 1000 );
 				}
 			}
-			else
-			{
-				// from connected client
-				if( pev->events & EPOLLIN ) // we waited incoming message completition
-				{
-					count = net_recv( pev->data.fd, buf, sizeof buf );
+			// from connected client
+			else if( !worker_conn_event( epollfd, conn, ntl ) )
+				conn_close( &pool, conn );
+		}
 
-					if( count == -1 )
-						perror( "net_recv::conn_sock" );
+		if( !db_ready )
+			continue;
 
-					else if( count ) // have data
-					{
-						msg.readcount	= 0;
-						msg.maxsize		= count;
-
-						if( client_read_message( pev->data.fd, &msg, ntl ) )
-						{
-							ev.events	= EPOLLOUT | EPOLLET; // now we wait out message completition for socket close
-							ev.data.fd	= conn_sock;
-
-							if( epoll_ctl( epollfd, EPOLL_CTL_MOD, pev->data.fd, &ev ) == -1 ) // EPOLLIN -> EPOLLOUT
-							{
-								perror( "epoll_ctl::conn_sock" );
-								return EXIT_FAILURE;
-							}
-						}
-						continue;
-					}
-				}
-				// else EPOLLOUT (or disconnected, or error)
-				net_closesocket( pev->data.fd );
-			}
+		// answer and continue connections waiting for database
+		for( job = db_completed( ntl->db, thread_id ); job; job = next )
+		{
+			next = job->next;
+
+			if( ( conn = conn_job_done( job, ntl ) ) != NULL && !worker_conn_event( epollfd, conn, ntl ) )
+				conn_close( &pool, conn );
 		}
 	}
 
@@ -345,8 +452,6 @@ static int CALLBACK service_thread( ntl_t* ntl )
 		if( atomic_load( &ntl->threads_signal ) == ts_exit )
 			return EXIT_SUCCESS;
 
-		clients_check_timeout( ntl, CONNECT_TIMEOUT );
-
 		/*sys_lock( ntl->threads_lock );
 		atomic_store( &ntl->threads_signal, ts_pause );
 
@@ -383,18 +488,44 @@ static int CALLBACK service_thread( ntl_t* ntl )
 	}
 }
 
+// returns when all work threads wait in pause, then shared structures can be changed without locks
+static void workers_pause( ntl_t* ntl )
+{
+	thread_t *thread, *end;
+
+	atomic_store( &ntl->threads_signal, ts_pause );
+	end = ntl->threads + ntl->threads_count;
+
+	for( thread = ntl->threads; thread < end; ++thread )
+	{
+		while( !atomic_load( &thread->paused ) )
+			sys_sleep( THREAD_CHECK_FREE );
+	}
+}
+
+static void workers_resume( ntl_t* ntl )
+{
+	atomic_store( &ntl->threads_signal, ts_no );
+}
+
 int main()
 {
-	int threads_count, i, running, exit_code;
+	int threads_count, i, running, exit_code, sessions_table, creds_cache, creds_ttl;
 	config_t cfg, settings, servers, srv;
 	ntl_t ntl;
 	net_t net;
+	sessions_t sessions;
+	creds_t creds;
+	state_t state, *pstate;
+	const char* state_file;
+	server_t* server;
 	char line[MAX_INPUT_LEN];
 
 	exit_code = EXIT_FAILURE;
 	cfg = settings = NULL;
 	memset( ( void * )&ntl, 0, sizeof( ntl_t ) );
 	memset( ( void * )&net, 0, sizeof( net_t ) );
+	memset( ( void * )&state, 0, sizeof( state_t ) );
 
 	do // loading
 	{
@@ -408,16 +539,43 @@ int main()
 		if( ( settings = xml_get_sub( cfg, "settings" ) ) == NULL )
 			break;
 
+		mem_init( settings );
+
+		// sessions and rate limits survive restart in state file, empty name turns it off
+		pstate = NULL;
+
+		if( ( state_file = xml_get_string( settings, "state_file" ) ) == XML_INVALID_STRING )
+			state_file = STATE_FILE;
+
+		if( *state_file && state_open( &state, state_file ) )
+			pstate = &state;
+
 		// get threads count from config, or set equal cpu cores
 		if( ( threads_count = xml_get_int( settings, "threads" ) ) == 0 )
 			threads_count = sys_get_cpu_cores();
 
 		// connect to database
-		if( ( ntl.db = db_init( settings ) ) == NULL )
+		if( ( ntl.db = db_init( settings, threads_count ) ) == NULL )
 			break;
 
 		// init network
-		if( !net_init( &net, xml_get_string( settings, "host" ), xml_get_int( settings, "port" ), threads_count ) )
+		if( !net_init( &net, settings, threads_count, pstate ) )
+			break;
+
+		// logins verified by database, repeated ones skip it until ttl
+		if( ( creds_cache = xml_get_int( settings, "creds_cache" ) ) <= 0 )
+			creds_cache = CREDS_CACHE;
+
+		if( ( creds_ttl = xml_get_int( settings, "creds_ttl" ) ) <= 0 )
+			creds_ttl = CREDS_TTL;
+
+		if( !creds_init( &creds, creds_cache, creds_ttl ) )
+			break;
+
+		ntl.creds = &creds;
+
+		// work threads check bans and logins in memory, old sets are freed by their epoch
+		if( !db_preload( ntl.db, net.clients.epoch, &creds ) )
 			break;
 
 		// link net to ntl
@@ -429,7 +587,7 @@ int main()
 
 		// init servers
 		ntl.servers_count	= xml_get_sub_count( servers );
-		ntl.servers			= ( server_t * )calloc( threads_count, sizeof( server_t ) );
+		ntl.servers			= ( server_t * )calloc( ntl.servers_count, sizeof( server_t ) );
 		srv					= xml_get_sub( servers, NULL );
 		i					= 0;
 		running				= 0;
@@ -448,6 +606,17 @@ int main()
 
 		printf( "Started service %i of %i servers\n", running, ntl.servers_count );
 
+		// online players by name for each server
+		if( ( sessions_table = xml_get_int( settings, "sessions_table" ) ) <= 0 )
+			sessions_table = SESSIONS_TABLE;
+
+		if( !sessions_init( &sessions, sessions_table, ntl.servers_count, pstate ) )
+			break;
+
+		ntl.sessions = &sessions;
+
+		client_restore( &ntl );
+
 		// start working threads
 		ntl.threads_count	= threads_count;
 		ntl.threads			= ( thread_t * )calloc( threads_count, sizeof( thread_t ) );
@@ -495,6 +664,44 @@ int main()
 				{
 					
 				}
+				else if( !strncmp( line, "players", 7 ) )
+				{
+					// players [server id]
+					line[strcspn( line, "\r\n" )] = '\0';
+
+					if( line[7] == '\0' )
+						sessions_print( &sessions, ntl.servers, SESSION_NONE );
+					else if( ( server = server_find_id( ntl.servers, ntl.servers_count, line + 7 + 1 ) ) != NULL )
+						sessions_print( &sessions, ntl.servers, server - ntl.servers );
+					else
+						printf( "no server %s\n", line + 7 + 1 );
+				}
+				else if( !strncmp( line, "mem", 3 ) )
+				{
+					mem_print();
+					printf( "evicted %i clients\n", client_evicted() );
+				}
+				else if( !strncmp( line, "forget", 6 ) )
+				{
+					// forget [login], after password change outside of server
+					line[strcspn( line, "\r\n" )] = '\0';
+					creds_forget( &creds, line[6] ? line + 6 + 1 : NULL );
+				}
+				else if( !strncmp( line, "top", 3 ) )
+				{
+					flood_print( net.clients.flood );
+				}
+				else if( !strncmp( line, "defrag", 6 ) )
+				{
+					workers_pause( &ntl );
+
+					// no thread reads retired clients now, and their blocks can be released
+					for( i = 0; i < threads_count; ++i )
+						epoch_flush( net.clients.limbos + i, &ntl );
+
+					mem_defrag( &net.clients );
+					workers_resume( &ntl );
+				}
 			}
 		}
 	} while( 0 );
@@ -505,6 +712,16 @@ int main()
 	db_close( ntl.db );
 	net_close( &net );
 
+	if( ntl.sessions )
+		sessions_free( ntl.sessions );
+
+	if( ntl.creds )
+		creds_free( ntl.creds );
+
+	state_close( &state );
+
+	mem_deinit();
+
 	if( exit_code == EXIT_FAILURE )
 	{
 		puts( "press enter to exit..." );
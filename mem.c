@@ -1,15 +1,507 @@
+#ifdef __windows__
+#include <windows.h>
+#define THREAD_LOCAL	__declspec( thread )
+#else
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#define THREAD_LOCAL	__thread
+#endif
 #include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
 #include "client.h"
+#include "ip_table.h"
+#include "config.h"
+#include "const.h"
 #include "mem.h"
 
-// I will write it later
+#define MEM_ALIGN( size, align )	( ( ( size ) + ( align ) - 1 ) & ~( ( align ) - 1 ) )
+
+static mem_t mem_clients;
+static mem_t mem_players;
+static int mem_huge;
+
+// mapped bytes of all caches. flood makes only clients, so players are counted but not limited
+static long mem_limit;
+static atomic_long mem_bytes;
+static atomic_long mem_peak;
+
+// each thread registers own free list in cache on first use
+static THREAD_LOCAL mem_local_t* mem_clients_local;
+static THREAD_LOCAL mem_local_t* mem_players_local;
+
+static void mem_lock( mem_t* mem )
+{
+	while( atomic_flag_test_and_set( &mem->lock ) );
+}
+
+static void mem_unlock( mem_t* mem )
+{
+	atomic_flag_clear( &mem->lock );
+}
+
+static void* mem_map( int size )
+{
+#ifdef __windows__
+	return VirtualAlloc( NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE );
+#else
+	void* block = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+	// needs reserved pages in vm.nr_hugepages, otherwise fallback to normal pages
+	if( mem_huge )
+		block = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+#endif
+
+	if( block == MAP_FAILED )
+	{
+		if( ( block = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 ) ) == MAP_FAILED )
+			return NULL;
+#ifdef MADV_HUGEPAGE
+		if( mem_huge )
+			madvise( block, size, MADV_HUGEPAGE );
+#endif
+	}
+
+	return block;
+#endif
+}
+
+static void mem_unmap( void* block, int size )
+{
+#ifdef __windows__
+	VirtualFree( block, 0, MEM_RELEASE );
+#else
+	munmap( block, size );
+#endif
+}
+
+static void mem_cache_init( mem_t* mem, const char* name, int size, int align )
+{
+	memset( mem, 0, sizeof( mem_t ) );
+	atomic_flag_clear( &mem->lock );
+	mem->name		= name;
+	mem->slot_size	= MEM_ALIGN( size, align );
+	mem->block_size	= mem_huge ? MEM_HUGE_BLOCK_SIZE : MEM_BLOCK_SIZE;
+}
+
+static void mem_cache_deinit( mem_t* mem )
+{
+	int i;
+
+	for( i = 0; i < mem->blocks_count; ++i )
+		mem_unmap( mem->blocks[i], mem->block_size );
+
+	for( i = 0; i < mem->locals_count; ++i )
+		free( ( void *)mem->locals[i] );
+
+	free( ( void *)mem->blocks );
+	memset( mem, 0, sizeof( mem_t ) );
+}
+
+// under lock. new block goes to shared list
+static int mem_grow( mem_t* mem )
+{
+	char *block, *slot;
+	void** blocks;
+	long bytes, peak;
+
+	// caller evicts and tries later
+	if( mem->limited && mem_limit && atomic_load( &mem_bytes ) + mem->block_size > mem_limit )
+		return 0;
+
+	if( mem->blocks_count == mem->blocks_max )
+	{
+		if( ( blocks = ( void ** )realloc( mem->blocks, ( mem->blocks_max + 16 ) * sizeof( void * ) ) ) == NULL )
+		{
+			fprintf( stderr, "mem: out of memory for %s\n", mem->name );
+			return 0;
+		}
+
+		mem->blocks		= blocks;
+		mem->blocks_max	+= 16;
+	}
+
+	if( ( block = ( char * )mem_map( mem->block_size ) ) == NULL )
+	{
+		fprintf( stderr, "mem: can't map block for %s\n", mem->name );
+		return 0;
+	}
+
+	mem->blocks[mem->blocks_count++] = block;
+	bytes = atomic_fetch_add( &mem_bytes, mem->block_size ) + mem->block_size;
+
+	for( peak = atomic_load( &mem_peak ); peak < bytes && !atomic_compare_exchange_weak( &mem_peak, &peak, bytes ); );
+
+	for( slot = block + mem->block_size - mem->slot_size; slot >= block; slot -= mem->slot_size )
+	{
+		*( void ** )slot	= mem->free;
+		mem->free			= slot;
+		++mem->free_count;
+	}
+
+	return 1;
+}
+
+static mem_local_t* mem_get_local( mem_t* mem, mem_local_t** plocal )
+{
+	mem_local_t* local;
+
+	if( *plocal )
+		return *plocal;
+
+	if( ( local = ( mem_local_t * )calloc( 1, sizeof( mem_local_t ) ) ) == NULL )
+		return NULL;
+
+	mem_lock( mem );
+
+	if( mem->locals_count < MEM_MAX_THREADS )
+		mem->locals[mem->locals_count++] = local;
+	else
+	{
+		free( ( void *)local );
+		local = NULL;
+	}
+
+	mem_unlock( mem );
+
+	return *plocal = local;
+}
+
+// moves up to count objects from src list to dst list
+static int mem_move_list( void** dst, void** src, int count )
+{
+	void* obj;
+	int n;
+
+	for( n = 0; n < count && ( obj = *src ) != NULL; ++n )
+	{
+		*src			= *( void ** )obj;
+		*( void ** )obj	= *dst;
+		*dst			= obj;
+	}
+
+	return n;
+}
+
+static void* mem_alloc( mem_t* mem, mem_local_t** plocal )
+{
+	mem_local_t* local;
+	void* obj;
+	int n;
+
+	// thread without own list (registry is full) takes objects under lock
+	if( ( local = mem_get_local( mem, plocal ) ) == NULL )
+	{
+		mem_lock( mem );
+
+		if( ( mem->free || mem_grow( mem ) ) && ( obj = mem->free ) != NULL )
+		{
+			mem->free = *( void ** )obj;
+			--mem->free_count;
+		}
+		else
+			obj = NULL;
+
+		mem_unlock( mem );
+	}
+	else
+	{
+		if( !local->free )
+		{
+			mem_lock( mem );
+
+			if( mem->free || mem_grow( mem ) )
+			{
+				n = mem_move_list( &local->free, &mem->free, MEM_BATCH );
+				mem->free_count	-= n;
+				local->count	+= n;
+			}
+
+			mem_unlock( mem );
+		}
+
+		if( ( obj = local->free ) != NULL )
+		{
+			local->free = *( void ** )obj;
+			--local->count;
+		}
+	}
+
+	if( obj )
+		atomic_fetch_add( &mem->used, 1 );
+
+	return obj;
+}
+
+static void mem_free( mem_t* mem, mem_local_t** plocal, void* obj )
+{
+	mem_local_t* local;
+	int n;
+
+	atomic_fetch_sub( &mem->used, 1 );
+
+	if( ( local = mem_get_local( mem, plocal ) ) == NULL )
+	{
+		mem_lock( mem );
+		*( void ** )obj	= mem->free;
+		mem->free		= obj;
+		++mem->free_count;
+		mem_unlock( mem );
+		return;
+	}
+
+	*( void ** )obj	= local->free;
+	local->free		= obj;
+
+	// thread frees more than allocates (objects of other threads), give half back
+	if( ++local->count > MEM_LOCAL_MAX )
+	{
+		mem_lock( mem );
+		n = mem_move_list( &mem->free, &local->free, MEM_LOCAL_MAX / 2 );
+		mem->free_count	+= n;
+		local->count	-= n;
+		mem_unlock( mem );
+	}
+}
+
+void mem_init( struct xml_s* cfg )
+{
+	mem_huge	= xml_get_bool( cfg, "huge_pages" ) > 0;
+	mem_limit	= ( long )xml_get_int( cfg, "mem_limit" ) * 1024 * 1024; // mb, 0 is no limit
+
+	atomic_init( &mem_bytes, 0 );
+	atomic_init( &mem_peak, 0 );
+
+	mem_cache_init( &mem_clients, "clients", sizeof( client_t ), CPU_CACHE_LINE );
+	mem_cache_init( &mem_players, "players", sizeof( player_t ), sizeof( void * ) );
+	mem_clients.limited = 1;
+}
+
+void mem_deinit()
+{
+	mem_cache_deinit( &mem_clients );
+	mem_cache_deinit( &mem_players );
+}
+
+static void mem_cache_print( mem_t* mem )
+{
+	printf( "%s: %i used of %i in %i blocks, %i kb\n", mem->name, atomic_load( &mem->used ),
+		mem->blocks_count * ( mem->block_size / mem->slot_size ), mem->blocks_count, mem->blocks_count * ( mem->block_size / 1024 ) );
+}
+
+void mem_print()
+{
+	mem_cache_print( &mem_clients );
+	mem_cache_print( &mem_players );
+
+	printf( "total %li kb, peak %li kb, limit ", atomic_load( &mem_bytes ) / 1024, atomic_load( &mem_peak ) / 1024 );
+
+	if( mem_limit )
+		printf( "%li kb\n", mem_limit / 1024 );
+	else
+		puts( "none" );
+}
 
 client_t* mem_alloc_client()
 {
-	return ( struct client_s *)malloc( sizeof( client_t ) );
+	return ( client_t * )mem_alloc( &mem_clients, &mem_clients_local );
 }
 
 void mem_free_client( client_t* client )
 {
-	free( ( void *)&client );
-}
\ No newline at end of file
+	mem_free( &mem_clients, &mem_clients_local, ( void *)client );
+}
+
+player_t* mem_alloc_player()
+{
+	return ( player_t * )mem_alloc( &mem_players, &mem_players_local );
+}
+
+void mem_free_player( player_t* player )
+{
+	mem_free( &mem_players, &mem_players_local, ( void *)player );
+}
+
+static int mem_compare_blocks( const void* a, const void* b )
+{
+	const char *x = *( const char ** )a, *y = *( const char ** )b;
+	return x < y ? -1 : x > y;
+}
+
+// blocks are sorted by address
+static int mem_find_block( const mem_t* mem, const void* obj )
+{
+	int low, high, mid;
+
+	for( low = 0, high = mem->blocks_count - 1; low <= high; )
+	{
+		mid = ( low + high ) / 2;
+
+		if( ( const char * )obj < ( const char * )mem->blocks[mid] )
+			high = mid - 1;
+		else if( ( const char * )obj >= ( const char * )mem->blocks[mid] + mem->block_size )
+			low = mid + 1;
+		else
+			return mid;
+	}
+
+	return -1;
+}
+
+// marks sparse blocks in evac and leaves in shared list only slots of kept blocks.
+// returns count of marked blocks
+static int mem_plan( mem_t* mem, char* evac )
+{
+	int *free_in, *order;
+	int per_block, i, j, k, tmp, spare, moving, marked;
+	void *obj, *kept;
+
+	per_block	= mem->block_size / mem->slot_size;
+	free_in		= ( int * )calloc( mem->blocks_count, sizeof( int ) );
+	order		= ( int * )malloc( mem->blocks_count * sizeof( int ) );
+
+	// all threads are paused, their free lists go back to shared one
+	for( i = 0; i < mem->locals_count; ++i )
+	{
+		mem->free_count += mem_move_list( &mem->free, &mem->locals[i]->free, mem->locals[i]->count );
+		mem->locals[i]->count = 0;
+	}
+
+	qsort( mem->blocks, mem->blocks_count, sizeof( void * ), mem_compare_blocks );
+
+	for( obj = mem->free; obj; obj = *( void ** )obj )
+		++free_in[mem_find_block( mem, obj )];
+
+	// fullest blocks first, keep them until their free slots can take objects of the rest
+	for( i = 0; i < mem->blocks_count; ++i )
+		order[i] = i;
+
+	for( i = 1; i < mem->blocks_count; ++i )
+	{
+		for( j = i; j > 0 && free_in[order[j]] < free_in[order[j - 1]]; --j )
+		{
+			tmp = order[j]; order[j] = order[j - 1]; order[j - 1] = tmp;
+		}
+	}
+
+	for( k = 0; k <= mem->blocks_count; ++k )
+	{
+		for( spare = 0, i = 0; i < k; ++i )
+			spare += free_in[order[i]];
+
+		for( moving = 0, i = k; i < mem->blocks_count; ++i )
+			moving += per_block - free_in[order[i]];
+
+		if( spare >= moving )
+			break;
+	}
+
+	memset( evac, 0, mem->blocks_count );
+
+	for( marked = 0, i = k; i < mem->blocks_count; ++i, ++marked )
+		evac[order[i]] = 1;
+
+	// rebuild shared list from kept blocks only
+	for( kept = NULL, mem->free_count = 0; ( obj = mem->free ) != NULL; )
+	{
+		mem->free = *( void ** )obj;
+
+		if( !evac[mem_find_block( mem, obj )] )
+		{
+			*( void ** )obj	= kept;
+			kept			= obj;
+			++mem->free_count;
+		}
+	}
+
+	mem->free = kept;
+	free( ( void *)order );
+	free( ( void *)free_in );
+
+	return marked;
+}
+
+// copies object from evacuated block to free slot of kept block
+static void* mem_relocate( mem_t* mem, const char* evac, void* obj )
+{
+	void* slot;
+
+	if( !obj || !evac[mem_find_block( mem, obj )] || ( slot = mem->free ) == NULL )
+		return obj;
+
+	mem->free = *( void ** )slot;
+	--mem->free_count;
+	memcpy( slot, obj, mem->slot_size );
+
+	return slot;
+}
+
+static void mem_release( mem_t* mem, const char* evac )
+{
+	int i, n;
+
+	for( i = n = 0; i < mem->blocks_count; ++i )
+	{
+		if( evac[i] )
+		{
+			mem_unmap( mem->blocks[i], mem->block_size );
+			atomic_fetch_sub( &mem_bytes, mem->block_size );
+		}
+		else
+			mem->blocks[n++] = mem->blocks[i];
+	}
+
+	mem->blocks_count = n;
+}
+
+void mem_defrag( struct net_clients_s* clients )
+{
+	ip_table_t* table;
+	atomic_intptr_t* value;
+	client_t *cl, *moved;
+	player_t *player, **pplayer;
+	char *evac_clients, *evac_players;
+	unsigned i;
+	int released;
+
+	table			= clients->table;
+	evac_clients	= ( char * )malloc( mem_clients.blocks_count + 1 );
+	evac_players	= ( char * )malloc( mem_players.blocks_count + 1 );
+	released		= mem_plan( &mem_clients, evac_clients ) + mem_plan( &mem_players, evac_players );
+
+	// every live client is in table, players are only referenced by clients
+	for( i = 0; i < ip_table_size( table ); ++i )
+	{
+		if( ( cl = ( client_t * )atomic_load( value = ip_table_value( table, i ) ) ) == NULL )
+			continue;
+
+		if( ( moved = ( client_t * )mem_relocate( &mem_clients, evac_clients, cl ) ) != cl )
+		{
+			atomic_store( value, ( intptr_t )moved );
+			timer_moved( &moved->timer );
+			cl = moved;
+		}
+
+		// first player is in client, others are linked
+		if( ( player = ( player_t * )mem_relocate( &mem_players, evac_players, ( player_t * )atomic_load( &cl->players ) ) ) != NULL )
+			atomic_store( &cl->players, ( intptr_t )player );
+
+		for( ; player; player = *pplayer )
+		{
+			pplayer = &player->next;
+
+			if( *pplayer )
+				*pplayer = ( player_t * )mem_relocate( &mem_players, evac_players, *pplayer );
+		}
+	}
+
+	mem_release( &mem_clients, evac_clients );
+	mem_release( &mem_players, evac_players );
+	free( ( void *)evac_clients );
+	free( ( void *)evac_players );
+
+	printf( "mem_defrag: released %i blocks, %i clients and %i players in %i + %i blocks\n", released,
+		atomic_load( &mem_clients.used ), atomic_load( &mem_players.used ), mem_clients.blocks_count, mem_players.blocks_count );
+}
@@ -1,14 +1,54 @@
 #ifndef MEM_H
 #define MEM_H
 
+#include <stdatomic.h>
+
+#define MEM_BLOCK_SIZE		( 64 * 1024 )
+#define MEM_HUGE_BLOCK_SIZE	( 2 * 1024 * 1024 )
+#define MEM_MAX_THREADS		64
+#define MEM_LOCAL_MAX		256		// objects in thread free list before half goes back to shared list
+#define MEM_BATCH			64		// objects moved between shared and thread lists at once
+
+// free objects of one thread, no locks needed
+typedef struct mem_local_s
+{
+	void*			free;
+	int				count;
+} mem_local_t;
+
+// slab cache for objects of one size. blocks are split into aligned slots,
+// freed slots go to free list of freeing thread and return to shared list in batches
 typedef struct mem_s
 {
-	void*	blocks[256];
-	int		blocks_count;
+	const char*		name;
+	int				slot_size;
+	int				block_size;
+	atomic_flag		lock;			// shared list, blocks and locals registry
+
+	void*			free;
+	int				free_count;
+
+	void**			blocks;
+	int				blocks_count;
+	int				blocks_max;
+
+	mem_local_t*	locals[MEM_MAX_THREADS];
+	int				locals_count;
+	atomic_int		used;
+	int				limited;		// can't grow over mem_limit
 } mem_t;
 
+struct xml_s;
+struct net_clients_s;
+
+void mem_init( struct xml_s* cfg );
+void mem_deinit();
+void mem_print();
 struct client_s* mem_alloc_client();
 void mem_free_client( struct client_s* client );
-void mem_defrag( mem_t* mem, struct net_clients_s* clients );
+struct player_s* mem_alloc_player();
+void mem_free_player( struct player_s* player );
+// moves objects out of sparse blocks and releases them. work threads must be paused
+void mem_defrag( struct net_clients_s* clients );
 
-#endif // MEM_H
\ No newline at end of file
+#endif // MEM_H
@@ -12,6 +12,12 @@
 	#include <netinet/in.h>
 	#include <errno.h>
 	#include <netdb.h>
+	#include <sys/uio.h>
+	#include <linux/filter.h>
+
+	#ifndef SO_ATTACH_REUSEPORT_CBPF
+	#define SO_ATTACH_REUSEPORT_CBPF	51
+	#endif
 #endif
 
 #include <ctype.h>
@@ -20,8 +26,12 @@
 #include <stdio.h>
 
 #include "client.h"
-#include "client_list.h"
+#include "ip_table.h"
+#include "epoch.h"
+#include "ratelimit.h"
+#include "flood.h"
 #include "protocol.h"
+#include "config.h"
 #include "servers.h"
 #include "net.h"
 #include "ntl.h"
@@ -175,10 +185,11 @@ static struct in_addr net_host_to_addr( const char* host )
 	return addr;
 }
 
-static socket_t net_listen( const char* host, int port )
+static socket_t net_listen( const char* host, int port, int reuseport, int backlog )
 {
 	struct sockaddr_in addr;
 	socket_t listen_sock;
+	int one;
 
 	if( !port )
 	{
@@ -203,6 +214,17 @@ static socket_t net_listen( const char* host, int port )
 		return 0;
 	}
 
+#ifndef __windows__
+	one = 1;
+
+	if( reuseport && setsockopt( listen_sock, SOL_SOCKET, SO_REUSEPORT, &one, sizeof one ) == SOCKET_ERROR )
+	{
+		net_closesocket( listen_sock );
+		net_error( "SO_REUSEPORT" );
+		return 0;
+	}
+#endif
+
 	if( bind( listen_sock, ( struct sockaddr *)&addr, sizeof addr ) == SOCKET_ERROR )
 	{
 		net_closesocket( listen_sock );
@@ -210,19 +232,76 @@ static socket_t net_listen( const char* host, int port )
 		return 0;
 	}
 
-	if( listen( listen_sock, 3 ) == SOCKET_ERROR )
+	if( listen( listen_sock, backlog ) == SOCKET_ERROR )
 	{
 		net_closesocket( listen_sock );
 		net_error( "listen" );
 		return 0;
 	}
 
-	printf( "Started listening on %i.%i.%i.%i:%i\n", IP_TO_ARGS( addr.sin_addr.s_addr ), addr.sin_port );
+	printf( "Started listening on %i.%i.%i.%i:%i\n", IP_TO_ARGS( addr.sin_addr.s_addr ), port );
 	return listen_sock;
 }
 
-int net_init( net_t* net, const char* host, int port, int threads_count )
+#ifndef __windows__
+// kernel picks listener in group by index returned from this program,
+// so every source ip always lands on the same worker thread
+static int net_attach_reuseport_cbpf( socket_t sock, int count )
+{
+	struct sock_filter code[] =
+	{
+		// A = source ip from ip header
+		{ BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_NET_OFF + 12 },
+		// A = ( A * golden ratio ) >> 16, spreads neighbour addresses
+		{ BPF_ALU | BPF_MUL | BPF_K, 0, 0, 0x9E3779B1 },
+		{ BPF_ALU | BPF_RSH | BPF_K, 0, 0, 16 },
+		// return A % listeners count
+		{ BPF_ALU | BPF_MOD | BPF_K, 0, 0, count },
+		{ BPF_RET | BPF_A, 0, 0, 0 }
+	};
+	struct sock_fprog prog;
+
+	prog.len	= sizeof code / sizeof code[0];
+	prog.filter	= code;
+
+	if( setsockopt( sock, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof prog ) == SOCKET_ERROR )
+	{
+		net_error( "SO_ATTACH_REUSEPORT_CBPF" );
+		return 0;
+	}
+
+	return 1;
+}
+
+static int net_listen_reuseport( net_t* net, const char* host, int port, int threads_count )
+{
+	int i;
+
+	net->listen_socks = ( socket_t * )calloc( threads_count, sizeof( socket_t ) );
+
+	// listeners join reuseport group in worker order, it is index for bpf program
+	for( i = 0; i < threads_count; ++i )
+	{
+		if( ( net->listen_socks[i] = net_listen( host, port, 1, net->listen_backlog ) ) == 0 )
+			break;
+	}
+
+	if( i == threads_count && net_attach_reuseport_cbpf( net->listen_socks[0], threads_count ) )
+		return 1;
+
+	while( i-- )
+		net_closesocket( net->listen_socks[i] );
+
+	free( ( void *)net->listen_socks );
+	net->listen_socks = NULL;
+	return 0;
+}
+#endif
+
+int net_init( net_t* net, struct xml_s* cfg, int threads_count, struct state_s* state )
 {
+	const char *host, *event_loop;
+	int port, i, clients_table;
 #ifdef __windows__
 	int err;
 	struct WSAData wsa;
@@ -234,19 +313,120 @@ int net_init( net_t* net, const char* host, int port, int threads_count )
 	}
 #endif
 
-	net->listen_sock		= net_listen( host, port );
-	net->clients.lists		= ( struct atomic_list_s *)calloc( threads_count, sizeof( atomic_list_t ) );
-	net->clients.end		= net->clients.lists + threads_count;
+	host = xml_get_string( cfg, "host" );
+	port = xml_get_int( cfg, "port" );
+
+	net->threads_count		= threads_count;
+
+	// launcher releases come as connection spikes, kernel queue must hold them
+	if( ( net->listen_backlog = xml_get_int( cfg, "listen_backlog" ) ) <= 0 )
+		net->listen_backlog = LISTEN_BACKLOG;
+
+	if( ( net->accept_budget = xml_get_int( cfg, "accept_budget" ) ) <= 0 )
+		net->accept_budget = ACCEPT_BUDGET;
+
+	// io_uring event loop for workers, epoll is default and fallback
+	if( ( event_loop = xml_get_string( cfg, "event_loop" ) ) != XML_INVALID_STRING && !strcmp( event_loop, "io_uring" ) )
+	{
+#ifdef HAVE_IO_URING
+		net->uring = 1;
+#else
+		fprintf( stderr, "net_init: built without io_uring support, using epoll\n" );
+#endif
+	}
+
+	// many requests per connection for gateways, off by default
+	net->keepalive			= xml_get_bool( cfg, "keepalive" ) > 0;
+
+	if( ( net->keepalive_timeout = xml_get_int( cfg, "keepalive_timeout" ) ) <= 0 )
+		net->keepalive_timeout = KEEPALIVE_TIMEOUT;
+
+	if( ( clients_table = xml_get_int( cfg, "clients_table" ) ) <= 0 )
+		clients_table = CLIENTS_TABLE;
+
+	net->clients.table		= ( struct ip_table_s *)malloc( sizeof( ip_table_t ) );
+
+	if( !ip_table_init( net->clients.table, clients_table ) )
+		return 0;
+
+	net->clients.wheels		= ( struct timer_wheel_s *)calloc( threads_count, sizeof( timer_wheel_t ) );
+
+	for( i = 0; i < threads_count; ++i )
+		timer_init( net->clients.wheels + i );
+
+	net->clients.flood		= ( struct flood_s *)malloc( sizeof( flood_t ) );
+
+	if( !flood_init( net->clients.flood, cfg ) )
+		return 0;
+
+	net->clients.ratelimit	= ( struct ratelimit_s *)calloc( 1, sizeof( ratelimit_t ) );
+
+	if( !ratelimit_init( net->clients.ratelimit, cfg, state ) )
+		return 0;
+
+	net->clients.epoch		= ( struct epoch_s *)malloc( sizeof( epoch_t ) );
+	net->clients.limbos		= ( struct epoch_limbo_s *)calloc( threads_count, sizeof( epoch_limbo_t ) );
+	net->clients.hands		= ( unsigned * )calloc( threads_count, sizeof( unsigned ) );
+
+	if( !epoch_init( net->clients.epoch, threads_count ) )
+		return 0;
+
+#ifndef __windows__
+	// one listener per worker with source ip steering
+	if( xml_get_bool( cfg, "reuseport" ) > 0 )
+	{
+		if( net_listen_reuseport( net, host, port, threads_count ) )
+		{
+			net->reuseport		= 1;
+			net->listen_sock	= net->listen_socks[0];
+			printf( "Reuseport enabled for %i listeners\n", threads_count );
+			return 1;
+		}
+
+		fprintf( stderr, "net_init: can't use reuseport, fallback to shared listener\n" );
+	}
+#endif
+
+	net->listen_sock		= net_listen( host, port, 0, net->listen_backlog );
 
 	return net->listen_sock ? 1 : 0;
 }
 
 void net_close( net_t* net )
 {
+	socket_t* sock;
+
 	if( net )
 	{
-		net_closesocket( net->listen_sock );
-		free( ( void *)net->clients.lists );
+		if( net->reuseport )
+		{
+			for( sock = net->listen_socks; sock < net->listen_socks + net->threads_count; ++sock )
+				net_closesocket( *sock );
+
+			free( ( void *)net->listen_socks );
+		}
+		else
+			net_closesocket( net->listen_sock );
+
+		if( net->clients.table )
+			ip_table_free( net->clients.table );
+
+		if( net->clients.epoch )
+			epoch_free( net->clients.epoch );
+
+		if( net->clients.ratelimit )
+			ratelimit_free( net->clients.ratelimit );
+
+		if( net->clients.flood )
+			flood_free( net->clients.flood );
+
+		free( ( void *)net->clients.table );
+		free( ( void *)net->clients.wheels );
+		free( ( void *)net->clients.epoch );
+		free( ( void *)net->clients.ratelimit );
+		free( ( void *)net->clients.flood );
+		free( ( void *)net->clients.limbos );
+		free( ( void *)net->clients.hands );
 		memset( ( void * )net, 0, sizeof( net_t ) );
 	}
 #ifdef __windows__
@@ -266,6 +446,44 @@ int net_send( socket_t sock, const char* data, int len )
 	return send( sock, data, len, 0 );
 }
 
+int net_sendv( socket_t sock, const net_buf_t* bufs, int count )
+{
+#ifdef __windows__
+	int i, sent, total;
+
+	for( i = 0, total = 0; i < count; ++i )
+	{
+		if( ( sent = net_send( sock, bufs[i].data, bufs[i].len ) ) <= 0 )
+			return total ? total : sent;
+
+		total += sent;
+
+		if( sent < bufs[i].len )
+			break;
+	}
+
+	return total;
+#else
+	struct iovec iov[NET_MAX_BUFS];
+	struct msghdr msg;
+	int i;
+
+	//you can implement encryption here
+	for( i = 0; i < count; ++i )
+	{
+		iov[i].iov_base	= ( void *)bufs[i].data;
+		iov[i].iov_len	= bufs[i].len;
+	}
+
+	memset( &msg, 0, sizeof msg );
+	msg.msg_iov		= iov;
+	msg.msg_iovlen	= count;
+
+	// one syscall for all buffers, no SIGPIPE if client already gone
+	return sendmsg( sock, &msg, MSG_NOSIGNAL );
+#endif
+}
+
 int net_closesocket( socket_t sock )
 {
 #ifdef __windows__
@@ -281,6 +499,7 @@ static LRESULT CALLBACK net_socket_wnd_proc( HWND hWnd, UINT iMsg, WPARAM wParam
 	ntl_t* ntl;
 	thread_t *t, *threads_end;
 	socket_t conn_sock;
+	ip_t ip;
 
 	if( iMsg <= WM_USER )
 		return DefWindowProc( hWnd, iMsg, wParam, lParam );
@@ -289,8 +508,13 @@ static LRESULT CALLBACK net_socket_wnd_proc( HWND hWnd, UINT iMsg, WPARAM wParam
 	{
 	case FD_ACCEPT: // new connection
 		ntl = ( ntl_t * )GetWindowLongPtrA( hWnd, GWL_USERDATA );
-		conn_sock = net_accept( ntl->net, 0 );
-		WSAAsyncSelect( conn_sock, hWnd, iMsg, FD_READ | FD_CLOSE );
+
+		// all clients are added here, so this thread owns the first wheel. it is the only remover, so doesn't wait readers
+		timer_advance( ntl->net->clients.wheels, timer_ticks(), ntl );
+		epoch_reclaim( ntl->net->clients.epoch, ntl->net->clients.limbos, ntl );
+
+		if( ( conn_sock = net_accept( ntl->net, 0, &ip ) ) != NET_NO_CONNECTION && conn_sock )
+			WSAAsyncSelect( conn_sock, hWnd, iMsg, FD_READ | FD_CLOSE );
 		break;
 
 	case FD_READ: // incoming data
@@ -345,15 +569,23 @@ int net_run( net_t* net, ntl_t* ntl )
 }
 #endif
 
-socket_t net_accept( net_t* net, int thread_id )
+socket_t net_accept( net_t* net, int thread_id, ip_t* ip )
 {
 	socket_t conn_sock;
 	struct sockaddr_in addr;
-	const client_t* client;
+#ifdef __windows__
 	int addrlen;
+#else
+	socklen_t addrlen;
+#endif
 
 	addrlen = sizeof addr;
-	conn_sock = accept( net->listen_sock, ( struct sockaddr *)&addr, &addrlen );
+#ifdef __windows__
+	conn_sock = accept( NET_LISTEN_SOCK( net, thread_id ), ( struct sockaddr *)&addr, &addrlen );
+#else
+	// socket comes nonblocking, no fcntl round trip
+	conn_sock = accept4( NET_LISTEN_SOCK( net, thread_id ), ( struct sockaddr *)&addr, &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC );
+#endif
 
 	if( conn_sock == INVALID_SOCKET )
 	{
@@ -363,22 +595,37 @@ socket_t net_accept( net_t* net, int thread_id )
 		if( errno != EAGAIN && errno != EWOULDBLOCK )
 #endif
 			net_error( "client accept" );
+		return NET_NO_CONNECTION;
+	}
+
+	*ip = addr.sin_addr.s_addr;
+	return net_accept_client( net, conn_sock, *ip, thread_id );
+}
+
+socket_t net_accept_client( net_t* net, socket_t conn_sock, ip_t ip, int thread_id )
+{
+	const client_t* client;
+
+	// flooding ip is closed before it gets any state, sketch memory is fixed
+	if( !flood_check( net->clients.flood, ip ) )
+	{
+		net_closesocket( conn_sock );
 		return 0;
 	}
 
-	client = client_find( net->clients, addr.sin_addr.s_addr );
+	// logged in player is not limited, others spend tokens of own ip and /24
+	if( ( client = client_find( net->clients, ip ) ) != NULL && atomic_load( &client->players ) )
+		return conn_sock;
 
-	if( client )
+	if( !ratelimit_check( net->clients.ratelimit, ip ) )
 	{
-		if( !client->player )
-		{
-			dbg( "client %i.%i.%i.%i not accepted\n", IP_TO_ARGS( addr.sin_addr.s_addr ) );
-			net_closesocket( conn_sock );
-			conn_sock = 0;
-		}
+		dbg( "client %i.%i.%i.%i not accepted\n", IP_TO_ARGS( ip ) );
+		net_closesocket( conn_sock );
+		return 0;
 	}
-	else
-		client_add( net->clients.lists + thread_id, addr.sin_addr.s_addr );
+
+	if( !client )
+		client_add( &net->clients, thread_id, ip );
 
 	return conn_sock;
 }
@@ -510,9 +757,14 @@ int net_send_answer( socket_t sock, int code )
 
 ip_t net_get_ip( socket_t sock )
 {
-	struct in_addr addr;
+	struct sockaddr_in addr;
+#ifdef __windows__
 	int len;
+#else
+	socklen_t len;
+#endif
 
+	// peer address is whole sockaddr, in_addr is only its part
 	len = sizeof addr;
 
 	if( getpeername( sock, ( struct sockaddr *)&addr, &len ) == SOCKET_ERROR )
@@ -521,7 +773,7 @@ ip_t net_get_ip( socket_t sock )
 		return INVALID_IP;
 	}
 
-	return addr.s_addr;
+	return addr.sin_addr.s_addr;
 }
 
 ip_t net_host_to_ip( const char* host )
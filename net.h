@@ -6,21 +6,46 @@
 
 #define IP_TO_ARGS( u )	u >> 24, ( u >> 16 ) & 0xFF, ( u >> 8 ) & 0xFF, u & 0xFF
 
+// listener of worker thread: own in reuseport mode, shared otherwise
+#define NET_LISTEN_SOCK( net, thread_id )	( ( net )->reuseport ? ( net )->listen_socks[thread_id] : ( net )->listen_sock )
+
+#define NET_MAX_BUFS		4
+#define NET_NO_CONNECTION	( ( socket_t )-1 )
+
+typedef struct net_buf_s
+{
+	const char*		data;
+	int				len;
+} net_buf_t;
+
 typedef struct net_s
 {
 	socket_t		listen_sock;
+	socket_t*		listen_socks;
+	int				reuseport;
+	int				uring;
+	int				keepalive;
+	int				keepalive_timeout;
+	int				threads_count;
+	int				listen_backlog;
+	int				accept_budget;
 	net_clients_t	clients;
 } net_t;
 
 struct server_s;
+struct xml_s;
+
+struct state_s;
 
-int net_init( net_t* net, const char* host, int port, int threads_count );
+int net_init( net_t* net, struct xml_s* cfg, int threads_count, struct state_s* state ); // state is NULL if not kept between runs
 void net_close( net_t* net );
 int net_recv( socket_t sock, char* data, int len );
 int net_send( socket_t sock, const char* data, int len );
+int net_sendv( socket_t sock, const net_buf_t* bufs, int count ); // count <= NET_MAX_BUFS
 int net_closesocket( socket_t sock );
 int net_run( net_t* net, struct ntl_s* ntl );
-socket_t net_accept( net_t* net, int thread_id );
+socket_t net_accept( net_t* net, int thread_id, ip_t* ip ); // NET_NO_CONNECTION if queue is empty, 0 if rejected. ip gets peer address
+socket_t net_accept_client( net_t* net, socket_t conn_sock, ip_t ip, int thread_id );
 int net_setnonblocking( socket_t sock );
 int net_server_connect( struct server_s* server );
 int net_server_command( struct server_s* server, const char* command );
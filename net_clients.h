@@ -1,10 +1,17 @@
 #ifndef NET_CLIENTS
 #define NET_CLIENTS
 
+// clients of all work threads by ip with their connection rate and flood sketch. expiry wheel, retired clients
+// and eviction clock of each work thread
 typedef struct net_clients_s
 {
-	struct atomic_list_s*			lists;
-	const struct atomic_list_s*		end;
+	struct ip_table_s*				table;
+	struct ratelimit_s*				ratelimit;
+	struct flood_s*					flood;
+	struct timer_wheel_s*			wheels;
+	struct epoch_s*					epoch;
+	struct epoch_limbo_s*			limbos;
+	unsigned*						hands;		// eviction clock of each work thread
 } net_clients_t;
 
 #endif // NET_CLIENTS
\ No newline at end of file
@@ -0,0 +1,437 @@
+#ifdef HAVE_IO_URING
+
+#define _GNU_SOURCE
+#include <liburing.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <poll.h>
+
+#include "client.h"
+#include "conn.h"
+#include "epoch.h"
+#include "database.h"
+#include "protocol.h"
+#include "servers.h"
+#include "net_uring.h"
+#include "const.h"
+#include "util.h"
+#include "net.h"
+#include "ntl.h"
+#include "sys.h"
+#include "dbg.h"
+
+#define URING_ENTRIES		256
+#define URING_BUFS			256		// must be power of 2
+#define URING_BUF_SIZE		128
+#define URING_BGID			0
+
+// user_data = conn | op, conn is malloc aligned so low bits are free
+#define URING_DATA( conn, op )	( ( __u64 )( uintptr_t )( conn ) | ( op ) )
+#define URING_CONN( data )		( ( conn_t * )( uintptr_t )( ( data ) & ~( __u64 )7 ) )
+#define URING_OP( data )		( ( int )( ( data ) & 7 ) )
+
+enum uring_op_e
+{
+	uop_accept,
+	uop_recv,
+	uop_send,
+	uop_close,
+	uop_timeout,
+	uop_db
+};
+
+typedef struct uring_s
+{
+	struct io_uring				ring;
+	struct io_uring_buf_ring*	br;
+	char*						bufs;
+	conn_pool_t					pool;
+	struct __kernel_timespec	idle_ts;
+	socket_t					listen_sock;
+	int							thread_id;
+} uring_t;
+
+static struct io_uring_sqe* uring_get_sqe( uring_t* u )
+{
+	struct io_uring_sqe* sqe;
+
+	// sq is full, flush it to kernel and try again
+	if( ( sqe = io_uring_get_sqe( &u->ring ) ) == NULL )
+	{
+		io_uring_submit( &u->ring );
+		sqe = io_uring_get_sqe( &u->ring );
+	}
+
+	return sqe;
+}
+
+static void uring_accept( uring_t* u )
+{
+	struct io_uring_sqe* sqe;
+
+	if( ( sqe = uring_get_sqe( u ) ) == NULL )
+		return;
+
+	io_uring_prep_multishot_accept( sqe, u->listen_sock, NULL, NULL, SOCK_CLOEXEC );
+	io_uring_sqe_set_data64( sqe, URING_DATA( NULL, uop_accept ) );
+}
+
+static void uring_db_poll( uring_t* u, int event_fd )
+{
+	struct io_uring_sqe* sqe;
+
+	if( ( sqe = uring_get_sqe( u ) ) == NULL )
+		return;
+
+	io_uring_prep_poll_multishot( sqe, event_fd, POLLIN );
+	io_uring_sqe_set_data64( sqe, URING_DATA( NULL, uop_db ) );
+}
+
+static void uring_recv( uring_t* u, conn_t* conn )
+{
+	struct io_uring_sqe* sqe;
+	int len;
+
+	// need both sqe in one submit for link
+	if( io_uring_sq_space_left( &u->ring ) < 2 )
+		io_uring_submit( &u->ring );
+
+	if( ( sqe = io_uring_get_sqe( &u->ring ) ) == NULL )
+	{
+		conn_close( &u->pool, conn );
+		return;
+	}
+
+	// kernel picks buffer from provided ring only when data arrived. don't read more than connection buffer can take
+	len = sizeof conn->buf - conn->len;
+	io_uring_prep_recv( sqe, conn->sock, NULL, len < URING_BUF_SIZE ? len : URING_BUF_SIZE, 0 );
+	sqe->flags		|= IOSQE_BUFFER_SELECT;
+	sqe->buf_group	= URING_BGID;
+	io_uring_sqe_set_data64( sqe, URING_DATA( conn, uop_recv ) );
+
+	// silent or idle keepalive connection: linked timeout cancels recv, then it is closed.
+	// kernel owns this deadline, conn can't be freed from wheel while recv is in flight.
+	// first message keeps deadline of accept, so client sending byte by byte can't extend it
+	sqe->flags |= IOSQE_IO_LINK;
+	sqe = io_uring_get_sqe( &u->ring );
+
+	if( conn->keepalive )
+		io_uring_prep_link_timeout( sqe, &u->idle_ts, 0 );
+	else
+		io_uring_prep_link_timeout( sqe, &conn->deadline, IORING_TIMEOUT_ABS );
+
+	io_uring_sqe_set_data64( sqe, URING_DATA( NULL, uop_timeout ) );
+}
+
+// conn goes back to pool at once, completions of close and send don't touch it
+static void uring_close( uring_t* u, conn_t* conn )
+{
+	struct io_uring_sqe* sqe;
+
+	if( ( sqe = uring_get_sqe( u ) ) == NULL )
+	{
+		conn_close( &u->pool, conn );
+		return;
+	}
+
+	io_uring_prep_close( sqe, conn->sock );
+	sqe->flags |= IOSQE_CQE_SKIP_SUCCESS;
+	io_uring_sqe_set_data64( sqe, URING_DATA( NULL, uop_close ) );
+	conn_free( &u->pool, conn );
+}
+
+// answers from conn output queue. conn stays alive until send completion
+static void uring_send( uring_t* u, conn_t* conn )
+{
+	struct io_uring_sqe* sqe;
+	const char* data;
+	int len;
+
+	// need both sqe in one submit for link
+	if( io_uring_sq_space_left( &u->ring ) < 2 )
+		io_uring_submit( &u->ring );
+
+	if( ( sqe = io_uring_get_sqe( &u->ring ) ) == NULL )
+	{
+		conn_close( &u->pool, conn );
+		return;
+	}
+
+	len = conn_out_chunk( conn, &data );
+	io_uring_prep_send( sqe, conn->sock, data, len, MSG_NOSIGNAL );
+	io_uring_sqe_set_data64( sqe, URING_DATA( conn, uop_send ) );
+
+	if( conn->keepalive )
+		return;
+
+	// one message connection: send + close in one submit. hardlink runs close even if send failed
+	sqe->flags |= IOSQE_IO_HARDLINK;
+	sqe = io_uring_get_sqe( &u->ring );
+	io_uring_prep_close( sqe, conn->sock );
+	sqe->flags |= IOSQE_CQE_SKIP_SUCCESS;
+	io_uring_sqe_set_data64( sqe, URING_DATA( NULL, uop_close ) );
+}
+
+static void uring_buf_return( uring_t* u, int bid )
+{
+	io_uring_buf_ring_add( u->br, u->bufs + bid * URING_BUF_SIZE, URING_BUF_SIZE, bid, io_uring_buf_ring_mask( URING_BUFS ), 0 );
+	io_uring_buf_ring_advance( u->br, 1 );
+}
+
+static void uring_process( uring_t* u, conn_t* conn, ntl_t* ntl )
+{
+	switch( conn_process( conn, ntl ) )
+	{
+	case cp_wait:
+		// keepalive connection: answer batch first, next recv after send
+		if( conn->out_len )
+			uring_send( u, conn );
+		else
+			uring_recv( u, conn );
+		break;
+
+	case cp_done:
+		uring_send( u, conn );
+		break;
+
+	case cp_error:
+		uring_close( u, conn );
+		break;
+
+	case cp_pending:
+		// no request in flight until database answers, so completion can't race with recv or send
+		break;
+	}
+}
+
+static void uring_handle( uring_t* u, struct io_uring_cqe* cqe, ntl_t* ntl )
+{
+	db_job_t *job, *next;
+	socket_t conn_sock;
+	conn_t* conn;
+	ip_t ip;
+	struct timespec now;
+	int bid, added;
+
+	conn = URING_CONN( cqe->user_data );
+
+	switch( URING_OP( cqe->user_data ) )
+	{
+	case uop_accept:
+		// multishot accept stopped (error or overflow), rearm it
+		if( !( cqe->flags & IORING_CQE_F_MORE ) )
+			uring_accept( u );
+
+		if( cqe->res < 0 )
+		{
+			if( cqe->res != -EAGAIN )
+				fprintf( stderr, "uring accept: %s\n", strerror( -cqe->res ) );
+			break;
+		}
+
+		// multishot accept shares one sockaddr for all completions, so ask peer address
+		ip = net_get_ip( cqe->res );
+
+		if( ( conn_sock = net_accept_client( ntl->net, cqe->res, ip, u->thread_id ) ) == 0 )
+			break;
+
+		if( ( conn = conn_alloc( &u->pool, conn_sock, ip ) ) == NULL )
+		{
+			net_closesocket( conn_sock );
+			break;
+		}
+
+		// absolute timeouts run on monotonic clock
+		clock_gettime( CLOCK_MONOTONIC, &now );
+		conn->deadline.tv_sec	= now.tv_sec + MESSAGE_TIMEOUT;
+		conn->deadline.tv_nsec	= now.tv_nsec;
+		uring_recv( u, conn );
+		break;
+
+	case uop_recv:
+		if( !( cqe->flags & IORING_CQE_F_BUFFER ) )
+		{
+			if( cqe->res == -ENOBUFS )
+				dbg( "uring recv: no provided buffers\n" );
+
+			uring_close( u, conn );
+			break;
+		}
+
+		// collect segments in connection buffer until full message
+		bid		= cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+		added	= cqe->res > 0 && conn_append( conn, u->bufs + bid * URING_BUF_SIZE, cqe->res );
+		uring_buf_return( u, bid );
+
+		if( !added )
+		{
+			uring_close( u, conn );
+			break;
+		}
+
+		uring_process( u, conn, ntl );
+		break;
+
+	case uop_send:
+		// one message connection is closed by linked close already
+		if( !conn->keepalive )
+		{
+			conn_free( &u->pool, conn );
+			break;
+		}
+
+		if( cqe->res <= 0 )
+		{
+			dbg( "uring send: %s\n", strerror( -cqe->res ) );
+			uring_close( u, conn );
+			break;
+		}
+
+		// rest of queue, then messages left in buffer when queue was full
+		conn_out_advance( conn, cqe->res );
+
+		if( conn->out_len )
+			uring_send( u, conn );
+		else
+			uring_process( u, conn, ntl );
+		break;
+
+	case uop_db:
+		if( !( cqe->flags & IORING_CQE_F_MORE ) )
+			uring_db_poll( u, db_event_fd( ntl->db, u->thread_id ) );
+
+		for( job = db_completed( ntl->db, u->thread_id ); job; job = next )
+		{
+			next = job->next;
+
+			if( ( conn = conn_job_done( job, ntl ) ) != NULL )
+				uring_process( u, conn, ntl );
+		}
+		break;
+
+	case uop_close:
+	case uop_timeout:
+		// success completions of close are skipped. timeout comes as -ETIME or -ECANCELED, recv handles it
+		break;
+	}
+}
+
+static int uring_init( uring_t* u, net_t* net, struct db_s* db, int thread_id )
+{
+	int err, i;
+
+	memset( u, 0, sizeof( uring_t ) );
+	u->thread_id		= thread_id;
+	u->listen_sock		= NET_LISTEN_SOCK( net, thread_id );
+	u->idle_ts.tv_sec	= net->keepalive_timeout;
+	u->pool.wheel		= net->clients.wheels + thread_id;
+	u->pool.thread_id	= thread_id;
+
+	if( ( err = io_uring_queue_init( URING_ENTRIES, &u->ring, 0 ) ) < 0 )
+	{
+		fprintf( stderr, "io_uring_queue_init: %s\n", strerror( -err ) );
+		return 0;
+	}
+
+	if( ( u->br = io_uring_setup_buf_ring( &u->ring, URING_BUFS, URING_BGID, 0, &err ) ) == NULL )
+	{
+		fprintf( stderr, "io_uring_setup_buf_ring: %s\n", strerror( -err ) );
+		io_uring_queue_exit( &u->ring );
+		return 0;
+	}
+
+	u->bufs = ( char * )malloc( URING_BUFS * URING_BUF_SIZE );
+
+	for( i = 0; i < URING_BUFS; ++i )
+		io_uring_buf_ring_add( u->br, u->bufs + i * URING_BUF_SIZE, URING_BUF_SIZE, i, io_uring_buf_ring_mask( URING_BUFS ), i );
+
+	io_uring_buf_ring_advance( u->br, URING_BUFS );
+	uring_accept( u );
+	uring_db_poll( u, db_event_fd( db, thread_id ) );
+
+	return 1;
+}
+
+static void uring_deinit( uring_t* u )
+{
+	io_uring_free_buf_ring( &u->ring, u->br, URING_BUFS, URING_BGID );
+	io_uring_queue_exit( &u->ring );
+	conn_pool_free( &u->pool );
+	free( ( void *)u->bufs );
+}
+
+int net_uring_worker( thread_t* thread )
+{
+	struct __kernel_timespec ts;
+	struct io_uring_cqe* cqe;
+	unsigned head, count;
+	ntl_t* ntl;
+	uring_t u;
+	int err;
+
+	ntl = thread->ntl;
+
+	if( !uring_init( &u, ntl->net, ntl->db, thread - ntl->threads ) )
+		return URING_UNAVAILABLE;
+
+	ts.tv_sec	= THREAD_TIMEOUT / 1000;
+	ts.tv_nsec	= ( THREAD_TIMEOUT % 1000 ) * 1000000;
+
+	for(;;)
+	{
+		// check global signals for work threads
+		switch( atomic_load( &ntl->threads_signal ) )
+		{
+		case ts_no:
+			break;
+
+		case ts_pause:
+			// stay here while signal is set, paused thread doesn't touch shared structures
+			atomic_store( &thread->paused, true );
+
+			while( atomic_load( &ntl->threads_signal ) == ts_pause )
+				sys_sleep( THREAD_CHECK_FREE );
+
+			atomic_store( &thread->paused, false );
+			break;
+
+		case ts_exit:
+			uring_deinit( &u );
+			return EXIT_SUCCESS;
+		}
+
+		// clients expire in the same wheel as in epoll loop
+		epoch_quiescent( ntl->net->clients.epoch, u.thread_id );
+		timer_advance( u.pool.wheel, timer_ticks(), ntl );
+		epoch_reclaim( ntl->net->clients.epoch, ntl->net->clients.limbos + u.thread_id, ntl );
+
+		// one syscall submits everything queued on previous pass and waits for events
+		if( ( err = io_uring_submit_and_wait_timeout( &u.ring, &cqe, 1, &ts, NULL ) ) < 0 && err != -ETIME && err != -EINTR )
+		{
+			fprintf( stderr, "io_uring_submit_and_wait: %s\n", strerror( -err ) );
+			uring_deinit( &u );
+			return EXIT_FAILURE;
+		}
+
+		count = 0;
+
+		io_uring_for_each_cqe( &u.ring, head, cqe )
+		{
+			uring_handle( &u, cqe, ntl );
+			++count;
+		}
+
+		io_uring_cq_advance( &u.ring, count );
+		atomic_store( &thread->timeout, count == 0 );
+	}
+
+	return EXIT_SUCCESS;
+}
+
+#endif // HAVE_IO_URING
\ No newline at end of file
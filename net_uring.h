@@ -0,0 +1,11 @@
+#ifndef NET_URING_H
+#define NET_URING_H
+
+#define URING_UNAVAILABLE		-1
+
+struct thread_s;
+
+// io_uring event loop for work thread. returns URING_UNAVAILABLE if ring can't be created
+int net_uring_worker( struct thread_s* thread );
+
+#endif // NET_URING_H
\ No newline at end of file
@@ -14,6 +14,8 @@ enum thread_signal_e
 struct net_s;
 struct db_s;
 struct server_s;
+struct sessions_s;
+struct creds_s;
 struct thread_s;
 struct server_s;
 struct pipe_data_s;
@@ -28,6 +30,8 @@ typedef struct ntl_s
 
 	struct server_s*		servers;
 	int						servers_count;
+	struct sessions_s*		sessions;
+	struct creds_s*			creds;			// verified logins
 
 	struct thread_s*		threads;
 	int						threads_count;
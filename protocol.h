@@ -10,8 +10,20 @@ enum ntl_protocol_e
 	ntl_command			= 'ntlc',
 	ntl_answer			= 'ntla',
 	ntl_echo			= 'ntle',
+	ntl_frame			= 'ntlm',
+	ntl_frame_keepalive	= 'ntlk',
 };
 
+// framed message: ntl_frame, word payload length, payload (ordinary message).
+// unframed messages are still accepted as one received chunk for old launchers
+#define NTL_FRAME_HEADER_LEN	6
+#define NTL_MAX_FRAME_LEN		( MAX_MSG_LEN - NTL_FRAME_HEADER_LEN )
+
+// keepalive frame: ntl_frame_keepalive, word payload length, dword request id, payload.
+// connection stays open, answers come in request order as { ntl_answer, code, request id }
+#define NTL_KEEPALIVE_HEADER_LEN	10
+#define NTL_MAX_KEEPALIVE_LEN		( MAX_MSG_LEN - NTL_KEEPALIVE_HEADER_LEN )
+
 enum ntl_error_e
 {
 	ntle_no_error,
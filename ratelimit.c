@@ -0,0 +1,140 @@
+#ifdef __windows__
+	#include <winsock2.h>
+#else
+	#include <arpa/inet.h>
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "ratelimit.h"
+#include "config.h"
+#include "timer.h"
+#include "state.h"
+
+static int ratelimit_table_init( ratelimit_table_t* table, const char* name, unsigned size, int rate, int burst, state_t* state )
+{
+	unsigned n;
+	int bits, restored;
+
+	for( n = 1, bits = 0; n < size; n <<= 1, ++bits );
+
+	// times of monotonic clock from before reboot are far from now, such buckets are full
+	if( state )
+	{
+		if( ( table->buckets = ( atomic_ullong * )state_get( state, name, RATELIMIT_VERSION, n * sizeof( atomic_ullong ), &restored ) ) == NULL )
+			return 0;
+
+		table->mapped = 1;
+	}
+	else if( ( table->buckets = ( atomic_ullong * )calloc( n, sizeof( atomic_ullong ) ) ) == NULL )
+	{
+		fprintf( stderr, "ratelimit_init: out of memory\n" );
+		return 0;
+	}
+
+	table->mask		= n - 1;
+	table->shift	= 32 - bits;
+	table->interval	= 60 * 1000 / rate;
+	table->limit	= table->interval * burst;
+
+	return 1;
+}
+
+int ratelimit_init( ratelimit_t* rl, struct xml_s* cfg, state_t* state )
+{
+	int size, ip_rate, ip_burst, subnet_rate, subnet_burst;
+
+	if( ( size = xml_get_int( cfg, "ratelimit_buckets" ) ) <= 0 )
+		size = RATELIMIT_BUCKETS;
+
+	// rates are connections per minute, burst is count of connections at once
+	if( ( ip_rate = xml_get_int( cfg, "ratelimit_ip_rate" ) ) <= 0 )
+		ip_rate = RATELIMIT_IP_RATE;
+
+	if( ( ip_burst = xml_get_int( cfg, "ratelimit_ip_burst" ) ) <= 0 )
+		ip_burst = RATELIMIT_IP_BURST;
+
+	if( ( subnet_rate = xml_get_int( cfg, "ratelimit_subnet_rate" ) ) <= 0 )
+		subnet_rate = RATELIMIT_SUBNET_RATE;
+
+	if( ( subnet_burst = xml_get_int( cfg, "ratelimit_subnet_burst" ) ) <= 0 )
+		subnet_burst = RATELIMIT_SUBNET_BURST;
+
+	return
+		ratelimit_table_init( &rl->ip, "ratelimit_ip", size, ip_rate, ip_burst, state ) &&
+		ratelimit_table_init( &rl->subnet, "ratelimit_subnet", size / 4, subnet_rate, subnet_burst, state );
+}
+
+void ratelimit_free( ratelimit_t* rl )
+{
+	// state file is unmapped by its owner
+	if( !rl->ip.mapped )
+		free( ( void *)rl->ip.buckets );
+
+	if( !rl->subnet.mapped )
+		free( ( void *)rl->subnet.buckets );
+
+	rl->ip.buckets = rl->subnet.buckets = NULL;
+}
+
+static int ratelimit_take( ratelimit_table_t* table, unsigned key, unsigned now )
+{
+	atomic_ullong* bucket;
+	unsigned long long old;
+	unsigned full;
+
+	bucket	= table->buckets + ( table->shift < 32 ? ( key * 0x9E3779B1u ) >> table->shift : 0 );
+	old		= atomic_load_explicit( bucket, memory_order_relaxed );
+
+	do
+	{
+		// full time is never more than limit ahead, so bigger distance means it is in past, or bucket of other key
+		full = ( unsigned )old;
+
+		if( ( unsigned )( old >> 32 ) != key || full - now > table->limit )
+			full = now;
+
+		if( ( full += table->interval ) - now > table->limit )
+			return 0;
+	}
+	while( !atomic_compare_exchange_weak( bucket, &old, ( unsigned long long )key << 32 | full ) );
+
+	return 1;
+}
+
+// returns token taken by ratelimit_take, unless bucket was given to other key since
+static void ratelimit_give( ratelimit_table_t* table, unsigned key )
+{
+	atomic_ullong* bucket;
+	unsigned long long old;
+
+	bucket	= table->buckets + ( table->shift < 32 ? ( key * 0x9E3779B1u ) >> table->shift : 0 );
+	old		= atomic_load_explicit( bucket, memory_order_relaxed );
+
+	do
+	{
+		if( ( unsigned )( old >> 32 ) != key )
+			return;
+	}
+	while( !atomic_compare_exchange_weak( bucket, &old, old - table->interval ) );
+}
+
+int ratelimit_check( ratelimit_t* rl, ip_t ip )
+{
+	unsigned now;
+
+	// coarse clock of timer wheels is enough, tokens come in 100 ms steps
+	now = timer_ticks() * TIMER_TICK;
+
+	if( !ratelimit_take( &rl->ip, ip, now ) )
+		return 0;
+
+	// connection rejected by subnet doesn't spend token of its ip
+	if( !ratelimit_take( &rl->subnet, htonl( ntohl( ip ) & 0xFFFFFF00 ), now ) )
+	{
+		ratelimit_give( &rl->ip, ip );
+		return 0;
+	}
+
+	return 1;
+}
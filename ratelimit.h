@@ -0,0 +1,35 @@
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+#include <stdatomic.h>
+#include "const.h"
+
+#define RATELIMIT_VERSION	1	// layout in state file
+
+// token bucket kept as time when it is full again: key in high half, msec in low half.
+// collided key takes over the bucket with full tokens, so table only fails open
+typedef struct ratelimit_table_s
+{
+	atomic_ullong*		buckets;
+	unsigned			mask;
+	int					shift;
+	unsigned			interval;	// msec per token
+	unsigned			limit;		// interval * burst
+	int					mapped;		// in state file
+} ratelimit_table_t;
+
+// buckets per ip and per /24, shared by all work threads without locks
+typedef struct ratelimit_s
+{
+	ratelimit_table_t	ip;
+	ratelimit_table_t	subnet;
+} ratelimit_t;
+
+struct xml_s;
+struct state_s;
+
+int ratelimit_init( ratelimit_t* rl, struct xml_s* cfg, struct state_s* state ); // with state, buckets are kept in state file
+void ratelimit_free( ratelimit_t* rl );
+int ratelimit_check( ratelimit_t* rl, ip_t ip ); // takes token of ip and its subnet, returns 0 if connection must be rejected
+
+#endif // RATELIMIT_H
@@ -0,0 +1,324 @@
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "session.h"
+#include "state.h"
+#include "servers.h"
+#include "ntl.h"
+#include "net.h"
+
+// lists of previous run could be cut in the middle of update, so they are made again from slots
+static void sessions_relink( sessions_t* sessions )
+{
+	session_t* session;
+	unsigned i;
+
+	for( i = 0; i < ( unsigned )sessions->servers_count; ++i )
+		sessions->heads[i] = SESSION_NONE;
+
+	for( i = 0, sessions->count = 0; i <= sessions->mask; ++i )
+	{
+		session = sessions->slots + i;
+
+		if( session->state != SESSION_USED )
+			continue;
+
+		if( session->server < 0 || session->server >= sessions->servers_count )
+		{
+			session->state = SESSION_TOMB;
+			continue;
+		}
+
+		session->name[MAX_PLAYER_NAME - 1]	= '\0';
+		session->prev						= SESSION_NONE;
+
+		if( ( session->next = sessions->heads[session->server] ) != SESSION_NONE )
+			sessions->slots[session->next].prev = i;
+
+		sessions->heads[session->server] = i;
+		++sessions->count;
+	}
+}
+
+int sessions_init( sessions_t* sessions, unsigned size, int servers_count, state_t* state )
+{
+	unsigned n, heads_size;
+	int i, restored;
+	char* mem;
+
+	for( n = 1; n < size; n <<= 1 );
+
+	memset( sessions, 0, sizeof( sessions_t ) );
+	heads_size = ( servers_count + 1 ) * sizeof( int );
+	restored = 0;
+
+	if( state )
+	{
+		// heads, then slots
+		if( ( mem = ( char * )state_get( state, "sessions", SESSION_VERSION, heads_size + n * sizeof( session_t ), &restored ) ) == NULL )
+			return 0;
+
+		sessions->heads		= ( int * )mem;
+		sessions->slots		= ( session_t * )( mem + heads_size );
+		sessions->mapped	= 1;
+	}
+	else
+	{
+		sessions->slots	= ( session_t * )calloc( n, sizeof( session_t ) );
+		sessions->heads	= ( int * )malloc( heads_size );
+
+		if( !sessions->slots || !sessions->heads )
+		{
+			fprintf( stderr, "sessions_init: out of memory\n" );
+			return 0;
+		}
+	}
+
+	sessions->mask			= n - 1;
+	sessions->servers_count	= servers_count;
+	atomic_flag_clear( &sessions->lock );
+
+	if( restored )
+	{
+		sessions_relink( sessions );
+		printf( "Restored %i sessions\n", sessions->count );
+	}
+	else
+	{
+		for( i = 0; i < servers_count; ++i )
+			sessions->heads[i] = SESSION_NONE;
+	}
+
+	return 1;
+}
+
+void sessions_free( sessions_t* sessions )
+{
+	// state file is unmapped by its owner
+	if( !sessions->mapped )
+	{
+		free( ( void *)sessions->slots );
+		free( ( void *)sessions->heads );
+	}
+
+	sessions->slots = NULL;
+	sessions->heads = NULL;
+}
+
+// names are case insensitive in game, so are sessions
+static unsigned session_hash( const char* name, int server )
+{
+	unsigned hash;
+
+	for( hash = 2166136261u ^ server; *name; ++name )
+		hash = ( hash ^ ( byte )tolower( ( byte )*name ) ) * 16777619u;
+
+	return hash;
+}
+
+static int session_equal( const session_t* session, const char* name, int server )
+{
+	const char* s;
+
+	if( session->server != server )
+		return 0;
+
+	for( s = session->name; *s && tolower( ( byte )*s ) == tolower( ( byte )*name ); ++s, ++name );
+
+	return *s == *name;
+}
+
+// returns slot of session, or SESSION_NONE. vacant gets first free slot in probe chain
+static int session_lookup( sessions_t* sessions, const char* name, int server, int* vacant )
+{
+	session_t* session;
+	unsigned i, n;
+
+	*vacant = SESSION_NONE;
+
+	for( i = session_hash( name, server ) & sessions->mask, n = 0; n <= sessions->mask; i = ( i + 1 ) & sessions->mask, ++n )
+	{
+		session = sessions->slots + i;
+
+		if( session->state == SESSION_USED )
+		{
+			if( session_equal( session, name, server ) )
+				return i;
+		}
+		else
+		{
+			if( *vacant == SESSION_NONE )
+				*vacant = i;
+
+			if( session->state == SESSION_EMPTY )
+				break;
+		}
+	}
+
+	return SESSION_NONE;
+}
+
+static void session_lock( sessions_t* sessions )
+{
+	while( atomic_flag_test_and_set_explicit( &sessions->lock, memory_order_acquire ) );
+}
+
+static void session_unlock( sessions_t* sessions )
+{
+	atomic_flag_clear_explicit( &sessions->lock, memory_order_release );
+}
+
+int session_add( sessions_t* sessions, const char* name, int server, ip_t ip, ip_t* replaced )
+{
+	session_t* session;
+	int i, vacant;
+
+	*replaced = INVALID_IP;
+
+	if( server < 0 || server >= sessions->servers_count )
+		return 0;
+
+	session_lock( sessions );
+
+	// same player again, session moves to new ip
+	if( ( i = session_lookup( sessions, name, server, &vacant ) ) != SESSION_NONE )
+	{
+		session			= sessions->slots + i;
+		*replaced		= session->ip;
+		session->ip		= ip;
+		session->since	= time( NULL );
+		session_unlock( sessions );
+		return 1;
+	}
+
+	if( vacant == SESSION_NONE )
+	{
+		session_unlock( sessions );
+		return 0;
+	}
+
+	session = sessions->slots + vacant;
+	strncpy( session->name, name, MAX_PLAYER_NAME - 1 );
+	session->name[MAX_PLAYER_NAME - 1]	= '\0';
+	session->server	= server;
+	session->ip		= ip;
+	session->since	= time( NULL );
+	session->state	= SESSION_USED;
+
+	// link to head of server list
+	session->prev	= SESSION_NONE;
+
+	if( ( session->next = sessions->heads[server] ) != SESSION_NONE )
+		sessions->slots[session->next].prev = vacant;
+
+	sessions->heads[server] = vacant;
+	++sessions->count;
+
+	session_unlock( sessions );
+	return 1;
+}
+
+int session_remove( sessions_t* sessions, const char* name, int server, ip_t ip )
+{
+	session_t* session;
+	unsigned n;
+	int i, vacant;
+
+	session_lock( sessions );
+
+	// session of the same name from other ip is newer login, it stays
+	if( ( i = session_lookup( sessions, name, server, &vacant ) ) == SESSION_NONE || sessions->slots[i].ip != ip )
+	{
+		session_unlock( sessions );
+		return 0;
+	}
+
+	session = sessions->slots + i;
+
+	if( session->prev != SESSION_NONE )
+		sessions->slots[session->prev].next = session->next;
+	else
+		sessions->heads[server] = session->next;
+
+	if( session->next != SESSION_NONE )
+		sessions->slots[session->next].prev = session->prev;
+
+	session->state = SESSION_TOMB;
+	--sessions->count;
+
+	// tombstones right before empty slot end no probe chain
+	if( sessions->slots[( i + 1 ) & sessions->mask].state == SESSION_EMPTY )
+	{
+		for( n = 0; n <= sessions->mask && sessions->slots[i].state == SESSION_TOMB; i = ( i - 1 ) & sessions->mask, ++n )
+			sessions->slots[i].state = SESSION_EMPTY;
+	}
+
+	session_unlock( sessions );
+	return 1;
+}
+
+int session_find( sessions_t* sessions, const char* name, int server, session_t* session )
+{
+	int i, vacant;
+
+	session_lock( sessions );
+
+	if( ( i = session_lookup( sessions, name, server, &vacant ) ) != SESSION_NONE )
+		*session = sessions->slots[i];
+
+	session_unlock( sessions );
+	return i != SESSION_NONE;
+}
+
+int sessions_next( sessions_t* sessions, int slot, session_t* session )
+{
+	session_lock( sessions );
+
+	for( ; slot <= ( int )sessions->mask && sessions->slots[slot].state != SESSION_USED; ++slot );
+
+	if( slot > ( int )sessions->mask )
+		slot = SESSION_NONE;
+	else
+		*session = sessions->slots[slot];
+
+	session_unlock( sessions );
+	return slot;
+}
+
+void sessions_print( sessions_t* sessions, server_t* servers, int server )
+{
+	session_t *list, *session, *end;
+	long now;
+	int i, first, last, count;
+
+	first	= server == SESSION_NONE ? 0 : server;
+	last	= server == SESSION_NONE ? sessions->servers_count - 1 : server;
+	now		= time( NULL );
+
+	for( server = first; server <= last; ++server )
+	{
+		// copy list of server, logins don't wait for console output
+		session_lock( sessions );
+
+		if( ( list = ( session_t * )malloc( ( sessions->count + 1 ) * sizeof( session_t ) ) ) == NULL )
+		{
+			session_unlock( sessions );
+			return;
+		}
+
+		for( i = sessions->heads[server], count = 0; i != SESSION_NONE; i = sessions->slots[i].next )
+			list[count++] = sessions->slots[i];
+
+		session_unlock( sessions );
+
+		printf( "%s: %i players\n", servers[server].id, count );
+
+		for( session = list, end = list + count; session < end; ++session )
+			printf( "  %-20s %i.%i.%i.%i %li min\n", session->name, IP_TO_ARGS( session->ip ), ( now - session->since ) / 60 );
+
+		free( ( void *)list );
+	}
+}
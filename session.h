@@ -0,0 +1,48 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <stdatomic.h>
+#include "const.h"
+
+#define SESSION_EMPTY		0
+#define SESSION_USED		1
+#define SESSION_TOMB		2
+#define SESSION_NONE		-1
+#define SESSION_VERSION		1			// layout in state file
+
+// logged in player on server, linked in list of its server
+typedef struct session_s
+{
+	char				name[MAX_PLAYER_NAME];
+	int					server;
+	ip_t				ip;
+	long				since;
+	int					state;
+	int					next, prev;		// slots in server list
+} session_t;
+
+// online players by name and server. open addressing under spinlock, it is taken only on login and expiry
+typedef struct sessions_s
+{
+	session_t*			slots;
+	unsigned			mask;
+	int*				heads;			// first slot of each server
+	int					servers_count;
+	int					count;
+	int					mapped;			// in state file
+	atomic_flag			lock;
+} sessions_t;
+
+struct server_s;
+struct state_s;
+
+// size is rounded up to power of 2. with state, sessions are kept in state file and restored from it
+int sessions_init( sessions_t* sessions, unsigned size, int servers_count, struct state_s* state );
+void sessions_free( sessions_t* sessions );
+int session_add( sessions_t* sessions, const char* name, int server, ip_t ip, ip_t* replaced ); // replaced gets ip of previous session or INVALID_IP
+int session_remove( sessions_t* sessions, const char* name, int server, ip_t ip ); // removes only session of this ip
+int session_find( sessions_t* sessions, const char* name, int server, session_t* session ); // copies session
+void sessions_print( sessions_t* sessions, struct server_s* servers, int server ); // server SESSION_NONE prints all
+int sessions_next( sessions_t* sessions, int slot, session_t* session ); // copies first session from slot, returns its slot or SESSION_NONE
+
+#endif // SESSION_H
@@ -0,0 +1,177 @@
+#ifdef __windows__
+#include <windows.h>
+#else
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include <string.h>
+#include <stdio.h>
+
+#include "state.h"
+
+static void* state_map( state_t* state, unsigned offset, unsigned size )
+{
+	void* ptr;
+#ifdef __windows__
+	HANDLE mapping;
+
+	// file grows to size of mapping
+	if( ( mapping = CreateFileMappingA( ( HANDLE )state->file, NULL, PAGE_READWRITE, 0, offset + size, NULL ) ) == NULL )
+		return NULL;
+
+	ptr = MapViewOfFile( mapping, FILE_MAP_ALL_ACCESS, 0, offset, size );
+	CloseHandle( mapping );
+#else
+	struct stat st;
+
+	if( fstat( state->fd, &st ) == -1 || ( st.st_size < offset + size && ftruncate( state->fd, offset + size ) == -1 ) )
+		return NULL;
+
+	if( ( ptr = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, state->fd, offset ) ) == MAP_FAILED )
+		ptr = NULL;
+#endif
+
+	if( ptr )
+	{
+		state->maps[state->maps_count]		= ptr;
+		state->sizes[state->maps_count++]	= size;
+	}
+
+	return ptr;
+}
+
+static void state_unmap( void* ptr, size_t size )
+{
+#ifdef __windows__
+	FlushViewOfFile( ptr, 0 );
+	UnmapViewOfFile( ptr );
+#else
+	msync( ptr, size, MS_ASYNC );
+	munmap( ptr, size );
+#endif
+}
+
+int state_open( state_t* state, const char* path )
+{
+	memset( state, 0, sizeof( state_t ) );
+
+#ifdef __windows__
+	SYSTEM_INFO si;
+
+	// views start on allocation granularity
+	GetSystemInfo( &si );
+	state->page = si.dwAllocationGranularity;
+
+	// not shared, file opened by other instance fails here
+	if( ( state->file = CreateFileA( path, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL ) ) == INVALID_HANDLE_VALUE )
+	{
+		fprintf( stderr, "state_open: can't open %s, it can be used by other instance\n", path );
+		return 0;
+	}
+#else
+	state->page = sysconf( _SC_PAGESIZE );
+
+	if( ( state->fd = open( path, O_RDWR | O_CREAT, 0600 ) ) == -1 )
+	{
+		perror( "state_open" );
+		return 0;
+	}
+
+	// tables are locked only between threads, other instance with reuseport would corrupt them
+	if( flock( state->fd, LOCK_EX | LOCK_NB ) == -1 )
+	{
+		perror( "state_open::flock" );
+		fprintf( stderr, "state_open: %s is used by other instance, running without it\n", path );
+		close( state->fd );
+		state->fd = 0;
+		return 0;
+	}
+#endif
+
+	if( ( state->header = ( state_header_t * )state_map( state, 0, state->page ) ) == NULL )
+	{
+		fprintf( stderr, "state_open: can't map %s\n", path );
+		state_close( state );
+		return 0;
+	}
+
+	// new file or file of other version starts empty
+	if( state->header->magic != STATE_MAGIC || state->header->version != STATE_VERSION || state->header->regions_count > STATE_REGIONS )
+	{
+		memset( state->header, 0, state->page );
+		state->header->magic	= STATE_MAGIC;
+		state->header->version	= STATE_VERSION;
+		state->header->end		= state->page;
+	}
+
+	return 1;
+}
+
+void state_close( state_t* state )
+{
+	int i;
+
+	for( i = 0; i < state->maps_count; ++i )
+		state_unmap( state->maps[i], state->sizes[i] );
+
+#ifdef __windows__
+	if( state->file && state->file != INVALID_HANDLE_VALUE )
+		CloseHandle( ( HANDLE )state->file );
+#else
+	if( state->fd > 0 )
+		close( state->fd );
+#endif
+
+	memset( state, 0, sizeof( state_t ) );
+}
+
+void* state_get( state_t* state, const char* name, unsigned version, unsigned size, int* restored )
+{
+	state_header_t* header;
+	state_region_t* region;
+	unsigned pages;
+	void* ptr;
+
+	header		= state->header;
+	pages		= ( size + state->page - 1 ) / state->page * state->page;
+	*restored	= 0;
+
+	for( region = header->regions; region < header->regions + header->regions_count; ++region )
+	{
+		if( !strcmp( region->name, name ) )
+			break;
+	}
+
+	if( region == header->regions + STATE_REGIONS )
+	{
+		fprintf( stderr, "state_get: no free region for %s\n", name );
+		return NULL;
+	}
+
+	// changed layout gets new space at end of file, old one is left until file is removed
+	if( region == header->regions + header->regions_count || region->version != version || region->size != size )
+	{
+		if( region == header->regions + header->regions_count )
+			++header->regions_count;
+
+		strncpy( region->name, name, STATE_NAME_LEN );
+		region->version	= version;
+		region->size	= size;
+		region->offset	= header->end;
+		header->end		+= pages;
+
+		if( ( ptr = state_map( state, region->offset, pages ) ) != NULL )
+			memset( ptr, 0, size );
+	}
+	else if( ( ptr = state_map( state, region->offset, pages ) ) != NULL )
+		*restored = 1;
+
+	if( !ptr )
+		fprintf( stderr, "state_get: can't map %s\n", name );
+
+	return ptr;
+}
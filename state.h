@@ -0,0 +1,51 @@
+#ifndef STATE_H
+#define STATE_H
+
+#include <stddef.h>
+
+#define STATE_MAGIC			0x534C544E	// "NTLS"
+#define STATE_VERSION		1
+#define STATE_REGIONS		16
+#define STATE_NAME_LEN		23
+
+// region of state file, owned by one module
+typedef struct state_region_s
+{
+	char				name[STATE_NAME_LEN + 1];
+	unsigned			version;	// layout of module data, region is reset when it changes
+	unsigned			offset;
+	unsigned			size;
+} state_region_t;
+
+// first page of state file
+typedef struct state_header_s
+{
+	unsigned			magic;
+	unsigned			version;
+	unsigned			end;		// offset for next region
+	unsigned			regions_count;
+	state_region_t		regions[STATE_REGIONS];
+} state_header_t;
+
+// memory mapped file with fixed layout regions, so tables survive restart without rebuilding.
+// each region is mapped separately, file grows without moving mapped regions
+typedef struct state_s
+{
+#ifdef __windows__
+	void*				file;
+#else
+	int					fd;
+#endif
+	state_header_t*		header;
+	unsigned			page;
+	void*				maps[STATE_REGIONS + 1];
+	size_t				sizes[STATE_REGIONS + 1];
+	int					maps_count;
+} state_t;
+
+int state_open( state_t* state, const char* path );
+void state_close( state_t* state );
+// maps region of module. restored is 1 if it has data of previous run, else region is zeroed
+void* state_get( state_t* state, const char* name, unsigned version, unsigned size, int* restored );
+
+#endif // STATE_H
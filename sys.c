@@ -1,8 +1,11 @@
 #ifdef __windows__
+#define _CRT_RAND_S
 #include <windows.h>
 #else
+#define _GNU_SOURCE
 #include <pthread.h>
 #include <unistd.h>
+#include <fcntl.h>
 typedef void* ( *PTHREAD_START_ROUTINE )( void * );
 #endif
 
@@ -119,7 +122,7 @@ int sys_create_workthread( thread_t* thread, thread_routine_t handler )
 	thread->handle = CreateThread( NULL, 0, ( PTHREAD_START_ROUTINE )handler, ( void * )thread, 0, NULL );
 	return thread->handle != NULL;
 #else
-	return pthread_create( &thread->handle, NULL, ( PTHREAD_START_ROUTINE )handler, ( void * )thread );
+	return pthread_create( &thread->handle, NULL, ( PTHREAD_START_ROUTINE )handler, ( void * )thread ) == 0;
 #endif
 }
 
@@ -145,6 +148,37 @@ void sys_sleep( dword msec )
 #endif
 }
 
+int sys_random( void* buf, int size )
+{
+#ifdef __windows__
+	unsigned value;
+	byte* p;
+
+	for( p = ( byte * )buf; size > 0; p += sizeof value, size -= sizeof value )
+	{
+		if( rand_s( &value ) )
+			return 0;
+
+		memcpy( p, &value, size < ( int )sizeof value ? size : sizeof value );
+	}
+
+	return 1;
+#else
+	int fd, res;
+
+	if( ( fd = open( "/dev/urandom", O_RDONLY | O_CLOEXEC ) ) == -1 )
+	{
+		perror( "sys_random::open" );
+		return 0;
+	}
+
+	res = read( fd, buf, size ) == size;
+	close( fd );
+
+	return res;
+#endif
+}
+
 #ifdef __windows__
 int __stdcall pipe_reader_thread( struct server_s* server );
 
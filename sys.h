@@ -25,6 +25,7 @@ thread_handle_t sys_create_thread( void* handler, void* arg );
 int sys_create_workthread( thread_t* thread, thread_routine_t handler );
 int sys_get_cpu_cores();
 void sys_sleep( dword msec );
+int sys_random( void* buf, int size ); // fills buf from system random source
 
 int sys_run_server( char* cmdline, server_t* server );
 int sys_write_server_console( server_t* server, const char* command );
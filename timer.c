@@ -0,0 +1,122 @@
+#ifdef __windows__
+#include <windows.h>
+#else
+#define _GNU_SOURCE
+#include <time.h>
+#endif
+#include <string.h>
+
+#include "timer.h"
+
+unsigned timer_ticks()
+{
+#ifdef __windows__
+	return ( unsigned )( GetTickCount64() / TIMER_TICK );
+#else
+	struct timespec ts;
+
+	// coarse clock is enough for 100 ms ticks and doesn't leave vdso
+	clock_gettime( CLOCK_MONOTONIC_COARSE, &ts );
+	return ( unsigned )ts.tv_sec * ( 1000 / TIMER_TICK ) + ( unsigned )( ts.tv_nsec / ( TIMER_TICK * 1000000 ) );
+#endif
+}
+
+void timer_init( timer_wheel_t* wheel )
+{
+	memset( wheel, 0, sizeof( timer_wheel_t ) );
+	wheel->now = timer_ticks();
+}
+
+static void timer_link( timer_wheel_t* wheel, timer_node_t* node )
+{
+	timer_node_t** slot;
+	unsigned delta;
+	int level;
+
+	// cascaded timer of current tick goes to slot which runs right now
+	if( ( int )( node->expires - wheel->now ) < 0 )
+		node->expires = wheel->now;
+
+	delta = node->expires - wheel->now;
+
+	for( level = 0; level < TIMER_LEVELS - 1 && delta >= 1u << ( ( level + 1 ) * TIMER_BITS ); ++level );
+
+	slot = &wheel->slots[level][( node->expires >> ( level * TIMER_BITS ) ) & TIMER_MASK];
+
+	if( ( node->next = *slot ) != NULL )
+		node->next->pprev = &node->next;
+
+	node->pprev	= slot;
+	*slot		= node;
+}
+
+void timer_set( timer_wheel_t* wheel, timer_node_t* node, unsigned msec, timer_func_t func )
+{
+	timer_del( node );
+
+	// at least one tick, so timer set from callback never runs in the same pass
+	node->expires	= wheel->now + ( msec + TIMER_TICK - 1 ) / TIMER_TICK + ( msec == 0 );
+	node->func		= func;
+
+	timer_link( wheel, node );
+}
+
+void timer_del( timer_node_t* node )
+{
+	if( !node->pprev )
+		return;
+
+	if( ( *node->pprev = node->next ) != NULL )
+		node->next->pprev = node->pprev;
+
+	node->next	= NULL;
+	node->pprev	= NULL;
+}
+
+void timer_moved( timer_node_t* node )
+{
+	if( !node->pprev )
+		return;
+
+	*node->pprev = node;
+
+	if( node->next )
+		node->next->pprev = &node->next;
+}
+
+// move timers of upper level slot to lower levels
+static void timer_cascade( timer_wheel_t* wheel, timer_node_t** slot )
+{
+	timer_node_t* node;
+
+	while( ( node = *slot ) != NULL )
+	{
+		timer_del( node );
+		timer_link( wheel, node );
+	}
+}
+
+void timer_advance( timer_wheel_t* wheel, unsigned now, void* arg )
+{
+	timer_node_t *node, **slot;
+	unsigned tick;
+	int level;
+
+	while( ( int )( now - wheel->now ) > 0 )
+	{
+		tick = ++wheel->now;
+
+		// lower level wrapped, bring next part of upper level down
+		for( level = 1; level < TIMER_LEVELS && !( tick & ( ( 1u << ( level * TIMER_BITS ) ) - 1 ) ); ++level )
+			timer_cascade( wheel, &wheel->slots[level][( tick >> ( level * TIMER_BITS ) ) & TIMER_MASK] );
+
+		// callback can set timer again, it goes to other slot
+		slot = &wheel->slots[0][tick & TIMER_MASK];
+
+		while( ( node = *slot ) != NULL )
+		{
+			timer_del( node );
+			node->func( node, arg );
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,41 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stddef.h>
+
+#define TIMER_TICK			100		// msec
+#define TIMER_BITS			6
+#define TIMER_SLOTS			( 1 << TIMER_BITS )
+#define TIMER_MASK			( TIMER_SLOTS - 1 )
+#define TIMER_LEVELS		4		// 64^4 ticks = 19 days max
+
+#define CONTAINER_OF( ptr, type, member )	( ( type * )( ( char * )( ptr ) - offsetof( type, member ) ) )
+
+struct timer_node_s;
+typedef void ( *timer_func_t )( struct timer_node_s* node, void* arg );
+
+typedef struct timer_node_s
+{
+	struct timer_node_s*	next;
+	struct timer_node_s**	pprev;		// NULL if not scheduled
+	unsigned				expires;	// in ticks
+	timer_func_t			func;
+} timer_node_t;
+
+// hierarchical timing wheel, one per work thread. add, delete and expiry are O(1)
+typedef struct timer_wheel_s
+{
+	unsigned				now;
+	timer_node_t*			slots[TIMER_LEVELS][TIMER_SLOTS];
+} timer_wheel_t;
+
+unsigned timer_ticks();
+void timer_init( timer_wheel_t* wheel );
+void timer_set( timer_wheel_t* wheel, timer_node_t* node, unsigned msec, timer_func_t func );
+void timer_del( timer_node_t* node );
+void timer_moved( timer_node_t* node ); // fixes links after node was copied to new place
+void timer_advance( timer_wheel_t* wheel, unsigned now, void* arg ); // runs expired timers up to now
+
+#define timer_pending( node )	( ( node )->pprev != NULL )
+
+#endif // TIMER_H
\ No newline at end of file
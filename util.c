@@ -137,7 +137,7 @@ static void hash_md5( const char* string, byte* result )
 	MD5_CTX ctx;
 
 	MD5_Init( &ctx );
-	MD5_Update( &ctx, &string, strlen( string ) );
+	MD5_Update( &ctx, ( void *)string, strlen( string ) );
 	MD5_Final( result, &ctx );
 }
 
@@ -172,6 +172,30 @@ hash_func_t get_hash_func( const char* name )
 	return NULL;
 }
 
+void hash_hex( hash_func_t func, const char* string, char* hex )
+{
+	static const char digits[] = "0123456789abcdef";
+	byte digest[32];
+	int i, len;
+
+	if( func == hash_md5 )
+		len = 16;
+	else if( func == hash_sha1 )
+		len = 20;
+	else
+		len = 32;
+
+	func( string, digest );
+
+	for( i = 0; i < len; ++i )
+	{
+		hex[i * 2]		= digits[digest[i] >> 4];
+		hex[i * 2 + 1]	= digits[digest[i] & 15];
+	}
+
+	hex[len * 2] = '\0';
+}
+
 int php_get_serialized( const char* blob, const char* var, char* value, int maxlen )
 {
 	const char *pos, *end;
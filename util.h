@@ -18,6 +18,7 @@ const char* msg_get_string( struct msg_s* msg, int maxlen );
 
 typedef void( *hash_func_t )( const char *, byte *);
 hash_func_t get_hash_func( const char* name );
+void hash_hex( hash_func_t func, const char* string, char* hex ); // lowercase hex digest, hex must hold MAX_DIGEST_HEX + 1
 
 int php_get_serialized( const char* blob, const char* var, char* value, int maxlen );
 